@@ -0,0 +1,639 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chain.h"
+#include "filter.h"
+#include "search.h"
+#include "store.h"
+
+// Benchmarks of the hot paths: the SHA-256 kernels, the per step work
+// of the walk, the membership filters, the stores and whole bloom mode
+// steps. Every result is one
+// JSON object per line on stdout, so runs can be diffed and tracked;
+// anything meant for people goes to stderr.
+
+#define BENCH_OPS 1000000UL
+#define BENCH_DIR "bench.XXXXXX"
+
+// kernels to try, the ones the CPU doesn't support are skipped
+static const char *const kernels[] = { "avx512", "avx2", "shani", "scalar" };
+// prefix lengths of the end-to-end runs
+static const unsigned int e2e_bits[] = { 32, 42, 64, 128 };
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+#define NUM_E2E_BITS (sizeof(e2e_bits) / sizeof(e2e_bits[0]))
+
+struct bench_options {
+	unsigned long ops;
+	unsigned int chains;
+	unsigned int bits;
+	double fpr;
+};
+
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned char *random_keys(unsigned long n, uint64_t seed) {
+	// n trimmed hashes of the current prefix length, back to back
+	unsigned char *keys = malloc(n * hashlen);
+	unsigned char key[SHA256_HASH_SIZE];
+
+	for (unsigned long i = 0; keys && i < n; i++) {
+		for (size_t j = 0; j < SHA256_HASH_SIZE; j += sizeof(uint64_t)) {
+			uint64_t x = splitmix64(&seed);
+			memcpy(key + j, &x, sizeof(x));
+		}
+		trim_hash(key);
+		memcpy(keys + i * hashlen, key, hashlen);
+	}
+
+	return keys;
+}
+
+static void result_begin(const char *bench, const char *name, unsigned long ops,
+		double secs) {
+	printf("{\"bench\":\"%s\",\"name\":\"%s\",\"bits\":%u,\"ops\":%lu,"
+			"\"secs\":%.6f,\"ops_per_sec\":%.0f", bench, name, bitlen, ops,
+			secs, ops / secs);
+}
+
+static void result_end(void) {
+	printf("}\n");
+	fflush(stdout);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void result_latency(uint32_t *ns, unsigned long n) {
+	// mean and percentiles of per-operation times, which include the
+	// ~20ns of reading the clock
+	double sum = 0;
+
+	qsort(ns, n, sizeof(*ns), cmp_u32);
+	for (unsigned long i = 0; i < n; i++) {
+		sum += ns[i];
+	}
+	printf(",\"mean_ns\":%.1f,\"p50_ns\":%u,\"p99_ns\":%u,\"p999_ns\":%u,"
+			"\"max_ns\":%u", sum / n, ns[n / 2], ns[n * 99 / 100],
+			ns[n * 999 / 1000], ns[n - 1]);
+}
+
+
+static void bench_hash(const struct bench_options *opts) {
+	unsigned long n = opts->ops;
+	unsigned char data[MAX_CHAINS][SHA256_HASH_SIZE];
+	double t;
+
+	for (size_t k = 0; k < NUM_KERNELS; k++) {
+		if (sha256_select_kernel(kernels[k]) != SHA_DIGEST_OK) {
+			fprintf(stderr, "Skipping the %s kernel, not supported here.\n",
+					kernels[k]);
+			continue;
+		}
+		const char *kernel = sha256_kernel_name();
+
+		// the context based functions, on whole bytes and on the prefix;
+		// every digest is the next message so nothing can be skipped
+		memset(data, 0xAA, sizeof(data));
+		t = now();
+		for (unsigned long i = 0; i < n; i++) {
+			SHA256_Context ctx;
+
+			sha256_initialize(&ctx);
+			sha256_add_bytes(&ctx, data[0], hashlen);
+			sha256_calculate(&ctx, data[0]);
+		}
+		result_begin("hash", "sha256_add_bytes", n, now() - t);
+		printf(",\"kernel\":\"%s\"", kernel);
+		result_end();
+
+		t = now();
+		for (unsigned long i = 0; i < n; i++) {
+			SHA256_Context ctx;
+
+			sha256_initialize(&ctx);
+			sha256_add_bits(&ctx, data[0], bitlen);
+			sha256_calculate(&ctx, data[0]);
+		}
+		result_begin("hash", "sha256_add_bits", n, now() - t);
+		printf(",\"kernel\":\"%s\"", kernel);
+		result_end();
+
+		// what the searches use: a single block without the context,
+		// one chain at a time or interleaved
+		t = now();
+		for (unsigned long i = 0; i < n; i++) {
+			sha256_short(data[0], bitlen, data[0]);
+		}
+		result_begin("hash", "sha256_short", n, now() - t);
+		printf(",\"kernel\":\"%s\"", kernel);
+		result_end();
+
+		unsigned long rounds = n / opts->chains;
+		t = now();
+		for (unsigned long i = 0; i < rounds; i++) {
+			sha256_short_many(data, SHA256_HASH_SIZE, bitlen, opts->chains,
+					data[0]);
+		}
+		result_begin("hash", "sha256_short_many", rounds * opts->chains,
+				now() - t);
+		printf(",\"kernel\":\"%s\",\"chains\":%u", kernel, opts->chains);
+		result_end();
+	}
+
+	sha256_select_kernel(NULL);
+}
+
+static void bench_chain(const struct bench_options *opts) {
+	// the per step work of the searches besides hashing and probing:
+	// trimming, the key and comparing to the previous value, on their
+	// own over random hashes and as part of the walk
+	unsigned long n = opts->ops;
+	unsigned int chains = opts->chains;
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char *keys = malloc(n * SHA256_HASH_SIZE);
+	uint64_t seed = 1, sum = 0;
+	double t;
+
+	if (keys == NULL) {
+		fprintf(stderr, "Failed to allocate the keys.\n");
+		return;
+	}
+	for (unsigned long i = 0; i < n * SHA256_HASH_SIZE / sizeof(seed); i++) {
+		uint64_t x = splitmix64(&seed);
+
+		memcpy(keys + i * sizeof(x), &x, sizeof(x));
+	}
+
+	t = now();
+	for (unsigned long i = 1; i < n; i++) {
+		unsigned char *key = keys + i * SHA256_HASH_SIZE;
+
+		trim_hash(key);
+		sum += hash_key(key) + hash_equal(key, key - SHA256_HASH_SIZE);
+	}
+	result_begin("chain", "trim_key_equal", n - 1, now() - t);
+	result_end();
+	free(keys);
+
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(c, prev[c]);
+	}
+	unsigned long rounds = n / chains;
+	t = now();
+	for (unsigned long r = 0; r < rounds; r++) {
+		sha256_short_many(prev, SHA256_HASH_SIZE, bitlen, chains, hash[0]);
+
+		for (unsigned int c = 0; c < chains; c++) {
+			size_t len = trim_hash(hash[c]);
+
+			sum += hash_key(hash[c]) + hash_equal(hash[c], prev[c]);
+			memcpy(prev[c], hash[c], len);
+		}
+	}
+	result_begin("chain", "walk", rounds * chains, now() - t);
+	printf(",\"chains\":%u", chains);
+	result_end();
+
+	// keeps the loops from being optimized away
+	if (sum == 0) {
+		fprintf(stderr, "All keys were zero.\n");
+	}
+}
+
+struct tas_worker {
+	pthread_t thread;
+	struct filter *filter;
+	const unsigned char *keys;
+	unsigned long n;
+	unsigned long first;
+	// keys test_and_add() said were new
+	unsigned long fresh;
+};
+
+static void *tas_run(void *arg) {
+	// all keys, starting at a different one in every thread
+	struct tas_worker *w = arg;
+	int full;
+
+	for (unsigned long i = 0; i < w->n; i++) {
+		unsigned long k = (w->first + i) % w->n;
+
+		w->fresh += !w->filter->ops->test_and_add(w->filter,
+				w->keys + k * hashlen, &full);
+	}
+
+	return NULL;
+}
+
+static void bench_test_and_add(const struct filter_ops *ops,
+		const unsigned char *keys, unsigned long n, double fpr) {
+	// every thread adds every key, so each key has to come out new at
+	// most once; more would be a lost duplicate
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct tas_worker *w = calloc(threads, sizeof(*w));
+	unsigned long fresh = 0;
+	unsigned int started = 0;
+	struct filter f;
+	double t;
+
+	if (w == NULL || filter_init(&f, ops, bitlen, n, fpr, NULL, 0)) {
+		fprintf(stderr, "Failed to set up the %s filter.\n", ops->name);
+		free(w);
+		return;
+	}
+
+	t = now();
+	for (; started < threads; started++) {
+		w[started] = (struct tas_worker) {
+			.filter = &f,
+			.keys = keys,
+			.n = n,
+			.first = n / threads * started,
+		};
+		if (pthread_create(&w[started].thread, NULL, tas_run, &w[started])) {
+			break;
+		}
+	}
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(w[i].thread, NULL);
+		fresh += w[i].fresh;
+	}
+	result_begin("filter", "test_and_add", started * n, now() - t);
+	printf(",\"filter\":\"%s\",\"threads\":%u,\"keys\":%lu,\"fresh\":%lu",
+			ops->name, started, n, fresh);
+	result_end();
+
+	ops->free(&f);
+	free(w);
+}
+
+static void bench_filter(const struct bench_options *opts) {
+	unsigned long n = opts->ops;
+	unsigned char *keys = random_keys(n, 1);
+	unsigned char *absent = random_keys(n, 2);
+	double t;
+
+	if (keys == NULL || absent == NULL) {
+		fprintf(stderr, "Failed to allocate the filter benchmark keys.\n");
+		free(keys);
+		free(absent);
+		return;
+	}
+
+	for (size_t i = 0; filter_backends[i] != NULL; i++) {
+		const struct filter_ops *ops = filter_backends[i];
+		struct filter f;
+		unsigned long added = 0, hits = 0;
+
+		if (filter_init(&f, ops, bitlen, n, opts->fpr, NULL, 0)) {
+			fprintf(stderr, "Failed to set up the %s filter.\n", ops->name);
+			continue;
+		}
+
+		t = now();
+		while (added < n && !ops->add(&f, keys + added * hashlen)) {
+			added++;
+		}
+		// the one that filled it went in as well
+		added += added < n;
+		result_begin("filter", "add", added, now() - t);
+		printf(",\"filter\":\"%s\",\"bytes\":%zu", ops->name, ops->bytes(&f));
+		result_end();
+
+		t = now();
+		for (unsigned long k = 0; k < added; k++) {
+			hits += ops->check(&f, keys + k * hashlen);
+		}
+		result_begin("filter", "check_hit", added, now() - t);
+		printf(",\"filter\":\"%s\",\"hits\":%lu", ops->name, hits);
+		result_end();
+
+		hits = 0;
+		t = now();
+		for (unsigned long k = 0; k < n; k++) {
+			hits += ops->check(&f, absent + k * hashlen);
+		}
+		result_begin("filter", "check_miss", n, now() - t);
+		printf(",\"filter\":\"%s\",\"fpr\":%g,\"target_fpr\":%g", ops->name,
+				(double) hits / n, opts->fpr);
+		result_end();
+
+		// the same through the batched probes, as many keys at once as
+		// chains are hashed at once
+		if (ops->prefetch != NULL) {
+			unsigned char found[MAX_CHAINS];
+
+			hits = 0;
+			t = now();
+			for (unsigned long k = 0; k + opts->chains <= n; k += opts->chains) {
+				hits += filter_check_many(&f, absent + k * hashlen, hashlen,
+						opts->chains, found);
+			}
+			result_begin("filter", "check_miss_batched", n - n % opts->chains,
+					now() - t);
+			printf(",\"filter\":\"%s\",\"batch\":%u,\"fpr\":%g", ops->name,
+					opts->chains, (double) hits / n);
+			result_end();
+		}
+
+		ops->free(&f);
+		if (ops->test_and_add != NULL) {
+			bench_test_and_add(ops, keys, n, opts->fpr);
+		}
+	}
+
+	free(keys);
+	free(absent);
+}
+
+static void bench_store(const struct bench_options *opts) {
+	unsigned long n = opts->ops;
+	unsigned char *keys = random_keys(n, 3);
+	unsigned char *absent = random_keys(n, 4);
+	uint32_t *ns = malloc(n * sizeof(*ns));
+	unsigned char val[SHA256_HASH_SIZE + 1] = { 0 };
+	double t, start;
+
+	if (keys == NULL || absent == NULL || ns == NULL) {
+		fprintf(stderr, "Failed to allocate the store benchmark keys.\n");
+		goto out;
+	}
+
+	for (size_t i = 0; store_backends[i] != NULL; i++) {
+		const struct store_ops *ops = store_backends[i];
+		struct store s;
+		unsigned long found = 0;
+		int err = 0;
+
+		if (store_open(&s, ops, hashlen, hashlen + 1, n, 0)) {
+			fprintf(stderr, "Failed to set up the %s store.\n", ops->name);
+			continue;
+		}
+
+		// records are a step's trimmed hash and preimage plus chain, the
+		// key of the next record makes as good a preimage as any
+		start = now();
+		for (unsigned long k = 0; k < n && !err; k++) {
+			memcpy(val, keys + ((k + 1) % n) * hashlen, hashlen);
+			t = now();
+			err = ops->put(&s, keys + k * hashlen, val);
+			ns[k] = (now() - t) * 1e9;
+		}
+		if (!err && ops->sync != NULL) {
+			err = ops->sync(&s);
+		}
+		if (err) {
+			fprintf(stderr, "Writing to the %s store failed.\n", ops->name);
+			ops->close(&s, 0);
+			continue;
+		}
+		// the total includes making it all durable, if the store can
+		result_begin("store", "put", n, now() - start);
+		printf(",\"store\":\"%s\"", ops->name);
+		result_latency(ns, n);
+		result_end();
+
+		// present keys in a different order than they were put in
+		start = now();
+		for (unsigned long k = 0; k < n; k++) {
+			unsigned long j = (k * 7919) % n;
+
+			t = now();
+			found += ops->get(&s, keys + j * hashlen, val) == 1;
+			ns[k] = (now() - t) * 1e9;
+		}
+		result_begin("store", "get_hit", n, now() - start);
+		printf(",\"store\":\"%s\",\"found\":%lu", ops->name, found);
+		result_latency(ns, n);
+		result_end();
+
+		// what bloom mode mostly looks up: filter false positives
+		found = 0;
+		start = now();
+		for (unsigned long k = 0; k < n; k++) {
+			t = now();
+			found += ops->get(&s, absent + k * hashlen, val) == 1;
+			ns[k] = (now() - t) * 1e9;
+		}
+		result_begin("store", "get_miss", n, now() - start);
+		printf(",\"store\":\"%s\",\"found\":%lu", ops->name, found);
+		result_latency(ns, n);
+		result_end();
+
+		ops->close(&s, 0);
+	}
+
+out:
+	free(keys);
+	free(absent);
+	free(ns);
+}
+
+static void bench_e2e(const struct bench_options *opts) {
+	// the inner loop of bloom mode with the default filter and store,
+	// minus the checkpoints: hash, filter check, verify the hits,
+	// filter add and store put
+	const struct filter_ops *fops = filter_backends[0];
+	const struct store_ops *sops = store_backends[0];
+	unsigned int chains = opts->chains;
+	unsigned long rounds = opts->ops / chains;
+	unsigned int bits = bitlen;
+
+	for (size_t b = 0; b < NUM_E2E_BITS; b++) {
+		unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE + 1];
+		unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+		unsigned char other[SHA256_HASH_SIZE + 1];
+		unsigned long queries = 0, collisions = 0;
+		struct filter f;
+		struct store s;
+		int err = 0;
+
+		// a CHAIN_BITS build only does its own length
+		if (chain_init(e2e_bits[b])) {
+			continue;
+		}
+		if (store_open(&s, sops, hashlen, hashlen + 1, opts->ops, 0)) {
+			fprintf(stderr, "Failed to set up the %s store.\n", sops->name);
+			continue;
+		}
+		if (filter_init(&f, fops, bitlen, opts->ops, opts->fpr, NULL, 0)) {
+			fprintf(stderr, "Failed to set up the %s filter.\n", fops->name);
+			sops->close(&s, 0);
+			continue;
+		}
+		for (unsigned int c = 0; c < chains; c++) {
+			chain_seed(c, prev[c]);
+		}
+
+		double t = now();
+		for (unsigned long r = 0; r < rounds && !err; r++) {
+			sha256_short_many(prev, sizeof(prev[0]), bitlen, chains, hash[0]);
+
+			for (unsigned int c = 0; c < chains; c++) {
+				size_t len = trim_hash(hash[c]);
+
+				if (fops->check(&f, hash[c])) {
+					int ret = sops->get(&s, hash[c], other);
+
+					err |= ret < 0;
+					queries += ret == 0;
+					if (ret > 0) {
+						// the chain would only go round its cycle from
+						// here on, give it a fresh start instead
+						chain_seed(chains + collisions++, prev[c]);
+						continue;
+					}
+				}
+				// sized for all of them, never full
+				fops->add(&f, hash[c]);
+				prev[c][len] = c;
+				err |= sops->put(&s, hash[c], prev[c]);
+				memcpy(prev[c], hash[c], len);
+			}
+		}
+		if (err) {
+			fprintf(stderr, "The %s store failed.\n", sops->name);
+		} else {
+			result_begin("e2e", "bloom_step", rounds * chains, now() - t);
+			printf(",\"filter\":\"%s\",\"store\":\"%s\",\"chains\":%u,"
+					"\"store_queries\":%lu,\"collisions\":%lu", fops->name,
+					sops->name, chains, queries, collisions);
+			result_end();
+		}
+
+		fops->free(&f);
+		sops->close(&s, 0);
+	}
+
+	chain_init(bits);
+}
+
+
+static const struct {
+	const char *name;
+	void (*run)(const struct bench_options *opts);
+} benches[] = {
+	{ "hash",   bench_hash },
+	{ "chain",  bench_chain },
+	{ "filter", bench_filter },
+	{ "store",  bench_store },
+	{ "e2e",    bench_e2e },
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+void usage(const char *name) {
+	printf("Usage: %s [-n ops] [-c chains] [-b bits] [-p fpr] [bench...]\n",
+			name);
+	printf("  -n ops     operations per benchmark (default %lu)\n", BENCH_OPS);
+	printf("  -c chains  chains hashed at once by sha256_short_many and in e2e\n");
+	printf("             (1-%d, default %d)\n", MAX_CHAINS, MAX_CHAINS);
+	printf("  -b bits    prefix length for hash, filter and store (default %d)\n",
+			BITLEN_DEFAULT);
+	printf("  -p fpr     false positive rate of the filters (default %g)\n",
+			DEFAULT_FPR);
+	printf("  bench      any of");
+	for (size_t i = 0; i < NUM_BENCHES; i++) {
+		printf(" %s", benches[i].name);
+	}
+	printf(" (default: all)\n");
+	printf("Results are printed as one JSON object per line.\n");
+}
+
+int main(int argc, char **argv) {
+	struct bench_options opts = {
+		.ops = BENCH_OPS,
+		.chains = MAX_CHAINS,
+		.bits = BITLEN_DEFAULT,
+		.fpr = DEFAULT_FPR,
+	};
+	char dir[] = BENCH_DIR;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:c:b:p:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			opts.ops = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			opts.chains = atoi(optarg);
+			break;
+		case 'b':
+			opts.bits = atoi(optarg);
+			break;
+		case 'p':
+			opts.fpr = atof(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (opts.ops < MAX_CHAINS || opts.chains < 1 || opts.chains > MAX_CHAINS ||
+			opts.fpr <= 0 || opts.fpr >= 1 || chain_init(opts.bits)) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (int i = optind; i < argc; i++) {
+		size_t b;
+
+		for (b = 0; b < NUM_BENCHES && strcmp(argv[i], benches[b].name); b++);
+		if (b == NUM_BENCHES) {
+			printf("Unknown benchmark '%s'.\n", argv[i]);
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// the stores put their files into the current directory,
+	// keep them away from those of a real run
+	if (mkdtemp(dir) == NULL || chdir(dir)) {
+		fprintf(stderr, "Failed to create a directory for the stores.\n");
+		return 1;
+	}
+
+	for (size_t b = 0; b < NUM_BENCHES; b++) {
+		int run = optind == argc;
+
+		for (int i = optind; i < argc; i++) {
+			run |= strcmp(argv[i], benches[b].name) == 0;
+		}
+		if (run) {
+			fprintf(stderr, "Running the %s benchmarks...\n", benches[b].name);
+			benches[b].run(&opts);
+		}
+	}
+
+	if (chdir("..") || rmdir(dir)) {
+		fprintf(stderr, "Failed to remove %s.\n", dir);
+	}
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include "chain.h"
+
+#ifndef CHAIN_BITS
+unsigned int bitlen;
+size_t hashlen;
+uint64_t chain_prefix_mask;
+#endif
+
+
+int chain_init(unsigned int bits) {
+	if (bits < BITLEN_MIN || bits > BITLEN_MAX) {
+		return 1;
+	}
+
+#ifndef CHAIN_BITS
+	bitlen = bits;
+	hashlen = (bits + 7) / 8;
+	chain_prefix_mask = CHAIN_PREFIX_MASK(bits);
+#endif
+
+	return 0;
+}
+
+void chain_seed(unsigned long long chain, unsigned char *seed) {
+	// 256 bits of "random" stuff, every further chain starts from
+	// a copy with the chain number xor-ed into the first bytes
+	static const unsigned char base[SHA256_HASH_SIZE] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+		0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA
+	};
+
+	memcpy(seed, base, SHA256_HASH_SIZE);
+	for (size_t i = 0; i < sizeof(chain); i++) {
+		seed[i] ^= (unsigned char) (chain >> (8 * i));
+	}
+	trim_hash(seed);
+}
+
+size_t chain_step(const unsigned char *prev, unsigned char *hash) {
+	// one step of the walk: hash the first bitlen bits of data
+	// (always fits into a single block, so skip the context)
+	// and trim the result, hash must have room for a full digest
+	sha256_short(prev, bitlen, hash);
+	return trim_hash(hash);
+}
+
+void chain_replay(unsigned long long step, unsigned int chains,
+		unsigned char *prev) {
+	// it's the chain's (step - 1) / chains-th value, prev must have
+	// room for a full digest
+	unsigned char next[SHA256_HASH_SIZE];
+
+	chain_seed((step - 1) % chains, prev);
+	for (unsigned long long i = (step - 1) / chains; i > 0; i--) {
+		chain_step(prev, next);
+		memcpy(prev, next, hashlen);
+	}
+}
+
+void print_hex(const unsigned char *data, size_t len) {
+	for (size_t i=0; i<len; i++) {
+		printf("%02X", data[i]);
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "sha256.h"
+
+// the first bits (up to 64) of a hash as a mask on its first 8 bytes
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CHAIN_PREFIX_MASK(bits) \
+	__builtin_bswap64((bits) >= 64 ? ~0ULL : ~0ULL << (64 - (bits)))
+#else
+#define CHAIN_PREFIX_MASK(bits) ((bits) >= 64 ? ~0ULL : ~0ULL << (64 - (bits)))
+#endif
+
+#ifdef CHAIN_BITS
+// a build for one prefix length only (make CHAIN_BITS=42) has it and
+// everything derived from it as constants, like before -b existed
+#define BITLEN_DEFAULT CHAIN_BITS
+#define BITLEN_MIN CHAIN_BITS
+#define BITLEN_MAX CHAIN_BITS
+
+static const unsigned int bitlen = CHAIN_BITS;
+static const size_t hashlen = (CHAIN_BITS + 7) / 8;
+static const uint64_t chain_prefix_mask = CHAIN_PREFIX_MASK(CHAIN_BITS);
+#else
+// supported lengths of the searched-for prefix collision in bits
+#define BITLEN_DEFAULT 42
+#define BITLEN_MIN 16
+#define BITLEN_MAX (SHA256_HASH_SIZE * 8)
+
+// length of the searched-for prefix collision in bits...
+extern unsigned int bitlen;
+// ...and of a trimmed hash in (whole) bytes
+extern size_t hashlen;
+// CHAIN_PREFIX_MASK(bitlen)
+extern uint64_t chain_prefix_mask;
+#endif
+
+// sets the prefix length, returns 0 on success and 1 for unsupported
+// lengths
+int chain_init(unsigned int bits);
+
+// The hot path functions, inlined into the search loops: with the length
+// from chain_init() they cost a load of it or two per call, trimming, the
+// key and the comparison of prefixes of up to 64 bits are a single 8-byte
+// load each. hash is a full digest buffer, ie. at least 8 bytes long.
+
+// trims a hash in place, returns its length in bytes; for prefixes of up
+// to 64 bits the rest of the first 8 bytes is zeroed too
+static inline size_t trim_hash(unsigned char *hash) {
+	if (bitlen <= 64) {
+		// a whole word, so that hash_key() reading it back right
+		// after gets it forwarded from the store
+		uint64_t x;
+
+		memcpy(&x, hash, sizeof(x));
+		x &= chain_prefix_mask;
+		memcpy(hash, &x, sizeof(x));
+	} else {
+		hash[hashlen - 1] &= 0xFF00 >> (bitlen % 8 ? bitlen % 8 : 8);
+	}
+
+	return hashlen;
+}
+
+// the trimmed hash as a number (right-aligned), for the modes that index
+// tables by it; only the first 64 bits for longer prefixes
+static inline uint64_t hash_key(const unsigned char *hash) {
+	uint64_t key;
+
+	memcpy(&key, hash, sizeof(key));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	key = __builtin_bswap64(key);
+#endif
+
+	return bitlen < 64 ? key >> (64 - bitlen) : key;
+}
+
+// compares two trimmed hashes
+static inline int hash_equal(const unsigned char *a, const unsigned char *b) {
+	return bitlen <= 64 ? hash_key(a) == hash_key(b) :
+			memcmp(a, b, hashlen) == 0;
+}
+
+void chain_seed(unsigned long long chain, unsigned char *seed);
+size_t chain_step(const unsigned char *prev, unsigned char *hash);
+// value hashed at the given (global, 1-based) step number when the given
+// number of chains are walked round-robin from chain_seed(0) on
+void chain_replay(unsigned long long step, unsigned int chains,
+		unsigned char *prev);
+void print_hex(const unsigned char *data, size_t len);
+
+#endif //CHAIN_H
@@ -0,0 +1,70 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+
+static void tmp_path(const char *path, char *tmp) {
+	snprintf(tmp, PATH_MAX, "%s.tmp", path);
+}
+
+static int sync_dir(const char *path) {
+	// the rename itself is only durable once the directory is synced
+	char dir[PATH_MAX];
+	char *slash;
+	int fd, ret;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+	} else {
+		*slash = '\0';
+	}
+
+	fd = open(dir, O_RDONLY);
+	if (fd < 0) {
+		return 1;
+	}
+	ret = fsync(fd);
+	close(fd);
+
+	return ret != 0;
+}
+
+FILE *checkpoint_begin(const char *path) {
+	char tmp[PATH_MAX];
+
+	tmp_path(path, tmp);
+	return fopen(tmp, "wb");
+}
+
+int checkpoint_commit(FILE *f, const char *path) {
+	char tmp[PATH_MAX];
+
+	tmp_path(path, tmp);
+	if (fflush(f) || fsync(fileno(f))) {
+		checkpoint_abort(f, path);
+		return 1;
+	}
+	if (fclose(f) || rename(tmp, path)) {
+		unlink(tmp);
+		return 1;
+	}
+
+	return sync_dir(path);
+}
+
+void checkpoint_abort(FILE *f, const char *path) {
+	char tmp[PATH_MAX];
+
+	tmp_path(path, tmp);
+	fclose(f);
+	unlink(tmp);
+}
+
+void checkpoint_remove(const char *path) {
+	unlink(path);
+}
@@ -0,0 +1,19 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+
+// Checkpoint files are replaced atomically: they are written to a
+// temporary file next to them, which is synced and renamed over the old
+// one only when complete, so a crash leaves either the old or the new one.
+
+// opens the temporary file for the given checkpoint, NULL on errors
+FILE *checkpoint_begin(const char *path);
+// syncs, closes and renames it into place, returns 0 on success
+int checkpoint_commit(FILE *f, const char *path);
+// drops a checkpoint that didn't work out
+void checkpoint_abort(FILE *f, const char *path);
+// removes the checkpoint once the run is over
+void checkpoint_remove(const char *path);
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,209 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dbwriter.h"
+
+// how long the writer naps when there's nothing to do
+#define IDLE_NSEC 50000
+// index slots per ring slot; it's rebuilt once its used slots (live and
+// committed records) reach INDEX_REBUILD times the ring size
+#define INDEX_FACTOR 2
+#define INDEX_REBUILD 1.5
+
+
+static void *dbwriter_run(void *arg) {
+	struct dbwriter *w = arg;
+	size_t rec_len = w->key_len + w->val_len;
+	struct timespec idle = { 0, IDLE_NSEC };
+
+	for (;;) {
+		unsigned long long tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+		unsigned long long head = atomic_load_explicit(&w->head, memory_order_acquire);
+
+		if (head == tail) {
+			if (atomic_load(&w->stop)) {
+				break;
+			}
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		if (head - tail > w->batch_max) {
+			head = tail + w->batch_max;
+		}
+		// a batch ends where the ring wraps around, the next one
+		// starts at its beginning
+		if ((tail & (w->slots - 1)) + (head - tail) > w->slots) {
+			head = tail + w->slots - (tail & (w->slots - 1));
+		}
+
+		if (w->write(w->db, w->ring + (tail & (w->slots - 1)) * rec_len,
+				head - tail)) {
+			atomic_store(&w->failed, 1);
+			break;
+		}
+
+		// only now the slots may be reused
+		atomic_store_explicit(&w->tail, head, memory_order_release);
+	}
+
+	return NULL;
+}
+
+static size_t index_home(const struct dbwriter *w, const void *key) {
+	uint64_t x = 0;
+
+	// keys are hashes, but maybe shorter than a word
+	memcpy(&x, key, w->key_len < sizeof(x) ? w->key_len : sizeof(x));
+	return (x * 0x9e3779b97f4a7c15ULL) >> 32 & (w->index_slots - 1);
+}
+
+static const unsigned char *ring_rec(const struct dbwriter *w,
+		unsigned long long i) {
+	return w->ring + (i & (w->slots - 1)) * (w->key_len + w->val_len);
+}
+
+static void index_add(struct dbwriter *w, unsigned long long rec,
+		unsigned long long tail) {
+	// the newest record of a key replaces its older one; slots of
+	// committed records are reused, but never emptied, so no probe
+	// sequence gets cut short
+	const unsigned char *key = ring_rec(w, rec);
+	size_t i = index_home(w, key);
+	uint64_t *reuse = NULL;
+
+	for (;; i = (i + 1) & (w->index_slots - 1)) {
+		uint64_t e = w->index[i];
+
+		if (e == 0) {
+			break;
+		}
+		if (e - 1 < tail) {
+			reuse = reuse != NULL ? reuse : &w->index[i];
+		} else if (memcmp(ring_rec(w, e - 1), key, w->key_len) == 0) {
+			w->index[i] = rec + 1;
+			return;
+		}
+	}
+
+	if (reuse == NULL) {
+		reuse = &w->index[i];
+		w->index_used++;
+	}
+	*reuse = rec + 1;
+}
+
+static void index_rebuild(struct dbwriter *w, unsigned long long head) {
+	unsigned long long tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+
+	memset(w->index, 0, w->index_slots * sizeof(*w->index));
+	w->index_used = 0;
+	for (unsigned long long i = tail; i < head; i++) {
+		index_add(w, i, tail);
+	}
+}
+
+int dbwriter_start(struct dbwriter *w,
+		int (*write)(void *db, const unsigned char *recs, size_t n), void *db,
+		size_t key_len, size_t val_len, size_t slots, size_t batch_max) {
+	w->write = write;
+	w->db = db;
+	w->key_len = key_len;
+	w->val_len = val_len;
+	w->slots = slots;
+	w->batch_max = batch_max;
+	atomic_init(&w->head, 0);
+	atomic_init(&w->tail, 0);
+	atomic_init(&w->stop, 0);
+	atomic_init(&w->failed, 0);
+
+	w->index_slots = INDEX_FACTOR * slots;
+	w->index_used = 0;
+	w->index = calloc(w->index_slots, sizeof(*w->index));
+	w->ring = malloc(slots * (key_len + val_len));
+	if (w->ring == NULL || w->index == NULL) {
+		free(w->index);
+		free(w->ring);
+		return 1;
+	}
+
+	if (pthread_create(&w->thread, NULL, dbwriter_run, w)) {
+		free(w->index);
+		free(w->ring);
+		return 1;
+	}
+
+	return 0;
+}
+
+int dbwriter_put(struct dbwriter *w, const void *key, const void *val) {
+	unsigned long long head = atomic_load_explicit(&w->head, memory_order_relaxed);
+	size_t rec_len = w->key_len + w->val_len;
+
+	// ring full, the writer has to catch up first
+	while (head - atomic_load_explicit(&w->tail, memory_order_acquire) >= w->slots) {
+		if (atomic_load(&w->failed)) {
+			return 1;
+		}
+		sched_yield();
+	}
+
+	unsigned char *rec = w->ring + (head & (w->slots - 1)) * rec_len;
+	memcpy(rec, key, w->key_len);
+	memcpy(rec + w->key_len, val, w->val_len);
+	atomic_store_explicit(&w->head, head + 1, memory_order_release);
+
+	if (w->index_used >= INDEX_REBUILD * w->slots) {
+		index_rebuild(w, head + 1);
+	} else {
+		index_add(w, head,
+				atomic_load_explicit(&w->tail, memory_order_acquire));
+	}
+
+	return atomic_load_explicit(&w->failed, memory_order_relaxed);
+}
+
+int dbwriter_get(struct dbwriter *w, const void *key, void *val) {
+	// a record at or after the tail can't have been overwritten, that
+	// only happens to its slot once the tail has passed it
+	unsigned long long tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+	size_t i = index_home(w, key);
+
+	for (;; i = (i + 1) & (w->index_slots - 1)) {
+		uint64_t e = w->index[i];
+
+		if (e == 0) {
+			return 0;
+		}
+		if (e - 1 >= tail && memcmp(ring_rec(w, e - 1), key, w->key_len) == 0) {
+			memcpy(val, ring_rec(w, e - 1) + w->key_len, w->val_len);
+			return 1;
+		}
+	}
+}
+
+int dbwriter_sync(struct dbwriter *w) {
+	unsigned long long head = atomic_load_explicit(&w->head, memory_order_relaxed);
+
+	while (atomic_load_explicit(&w->tail, memory_order_acquire) < head) {
+		if (atomic_load(&w->failed)) {
+			return 1;
+		}
+		sched_yield();
+	}
+
+	return 0;
+}
+
+int dbwriter_stop(struct dbwriter *w) {
+	atomic_store(&w->stop, 1);
+	pthread_join(w->thread, NULL);
+
+	free(w->index);
+	free(w->ring);
+	w->ring = NULL;
+	w->index = NULL;
+
+	return atomic_load(&w->failed);
+}
@@ -0,0 +1,61 @@
+#ifndef DBWRITER_H
+#define DBWRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Background LevelDB writer: the hashing thread drops fixed-size
+// (key, value) records into a single-producer/single-consumer ring buffer
+// and a writer thread commits them in large batches, so hashing only
+// ever waits for LevelDB if the ring runs full. Lookups don't wait for the
+// writer either: the producer keeps an index of the records still in the
+// ring and finds recent keys there, everything else is in LevelDB already.
+
+struct dbwriter {
+	// commits n records, back to back at recs, to the database in one
+	// batch; returns 0 on success
+	int (*write)(void *db, const unsigned char *recs, size_t n);
+	void *db;
+	pthread_t thread;
+
+	unsigned char *ring;
+	size_t slots;
+	size_t batch_max;
+	size_t key_len;
+	size_t val_len;
+
+	// records ever queued (by the producer) and committed (by the writer)
+	atomic_ullong head;
+	atomic_ullong tail;
+	atomic_int stop;
+	atomic_int failed;
+
+	// the producer's own open addressing index of the ring: record
+	// numbers plus one, 0 for empty; entries of committed records are
+	// skipped and only cleared out when the index is rebuilt
+	uint64_t *index;
+	size_t index_slots;
+	size_t index_used;
+};
+
+// starts the writer thread for records with the given key and value
+// lengths, written with write(db, ...); slots (a power of two) is the ring
+// buffer size in records; returns 0 on success
+int dbwriter_start(struct dbwriter *w,
+		int (*write)(void *db, const unsigned char *recs, size_t n), void *db,
+		size_t key_len, size_t val_len, size_t slots, size_t batch_max);
+// queues a record, returns 0 on success and 1 if an earlier write failed
+int dbwriter_put(struct dbwriter *w, const void *key, const void *val);
+// looks a key up among the records not committed yet, from the producer
+// thread: returns 1 and fills in val if it's there, 0 if it's either in
+// LevelDB already or nowhere
+int dbwriter_get(struct dbwriter *w, const void *key, void *val);
+// waits until everything queued so far is in LevelDB (for checkpoints);
+// returns 0 on success
+int dbwriter_sync(struct dbwriter *w);
+// commits what's left and stops the thread, returns 0 on success
+int dbwriter_stop(struct dbwriter *w);
+
+#endif //DBWRITER_H
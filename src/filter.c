@@ -0,0 +1,98 @@
+#include <string.h>
+#include "filter.h"
+#include "mem.h"
+
+
+const struct filter_ops *const filter_backends[] = {
+	&filter_scalable,
+	&filter_bloom,
+	&filter_blocked,
+	&filter_quotient,
+	&filter_atomic,
+	NULL,
+};
+
+const struct filter_ops *filter_find(const char *name) {
+	for (size_t i = 0; filter_backends[i] != NULL; i++) {
+		if (strcmp(name, filter_backends[i]->name) == 0) {
+			return filter_backends[i];
+		}
+	}
+
+	return NULL;
+}
+
+int filter_init(struct filter *f, const struct filter_ops *ops,
+		unsigned int key_bits, size_t capacity, double fpr, const char *path,
+		int keep) {
+	f->ops = ops;
+	f->key_bits = key_bits;
+	f->key_len = (key_bits + 7) / 8;
+	f->path = path;
+	f->keep = keep;
+	f->attached = 0;
+	f->priv = NULL;
+
+	if (path != NULL && ops->sync == NULL) {
+		printf("The %s filter grows, so it can't be kept in a file.\n",
+				ops->name);
+		return 1;
+	}
+
+	return ops->init(f, capacity, fpr);
+}
+
+void *filter_alloc(struct filter *f, size_t bytes, const uint64_t *params,
+		size_t n) {
+	uint64_t layout[MEM_FILE_PARAMS / sizeof(uint64_t)] = { f->key_bits };
+	void *p;
+
+	if (f->path == NULL) {
+		return mem_alloc(bytes);
+	}
+	if (n >= sizeof(layout) / sizeof(layout[0])) {
+		return NULL;
+	}
+	memcpy(layout + 1, params, n * sizeof(*params));
+
+	p = mem_map_file(f->path, f->ops->name, layout,
+			(n + 1) * sizeof(*layout), bytes, &f->attached);
+	// the keys of another walk would all look like hits to this one
+	if (p != NULL && f->attached && !f->keep) {
+		if (mem_file_clear(p)) {
+			printf("Failed to clear the filter in %s.\n", f->path);
+			mem_free(p);
+			return NULL;
+		}
+		printf("Cleared the keys a previous run left in %s.\n", f->path);
+		f->attached = 0;
+	}
+
+	return p;
+}
+
+void filter_prefetch_many(const struct filter *f, const void *keys,
+		size_t stride, size_t n) {
+	const unsigned char *k = keys;
+
+	if (f->ops->prefetch == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		f->ops->prefetch(f, k + i * stride);
+	}
+}
+
+size_t filter_check_many(struct filter *f, const void *keys, size_t stride,
+		size_t n, unsigned char *found) {
+	const unsigned char *k = keys;
+	size_t hits = 0;
+
+	filter_prefetch_many(f, keys, stride, n);
+	for (size_t i = 0; i < n; i++) {
+		found[i] = f->ops->check(f, k + i * stride);
+		hits += found[i];
+	}
+
+	return hits;
+}
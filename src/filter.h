@@ -0,0 +1,105 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Membership filters that tell bloom mode which steps are worth looking
+// up in the store: a filter may have false positives, but never false
+// negatives. Keys are fixed-length trimmed hashes.
+
+struct filter;
+
+struct filter_ops {
+	const char *name;
+	const char *description;
+	// set up an empty filter for capacity keys at the given false positive
+	// rate; fixed-size filters hold at most that many, growing ones take
+	// it as a hint; with f->path set it lives in that file, attaching to
+	// the keys already there; returns 0 on success
+	int (*init)(struct filter *f, size_t capacity, double fpr);
+	// returns 1 if the key is (probably) in the filter, 0 if it isn't
+	int (*check)(struct filter *f, const void *key);
+	// adds a key, returns 0 on success and 1 once the filter is full
+	int (*add)(struct filter *f, const void *key);
+	// check and add in one go, setting full like add() does; safe to call
+	// from several threads at once, and of two threads adding the same key
+	// at least one gets a 1; NULL for filters that aren't thread-safe
+	int (*test_and_add)(struct filter *f, const void *key, int *full);
+	// starts loading the memory check() and add() will look at for the
+	// key, so the cache misses of a batch of keys overlap; NULL for
+	// filters where that takes as long as the check itself
+	void (*prefetch)(const struct filter *f, const void *key);
+	// memory in use, in bytes
+	size_t (*bytes)(const struct filter *f);
+	// fraction of bits (bloom filters) or slots (quotient filter) set,
+	// for monitoring; may walk the whole filter, so call it rarely
+	double (*fill)(const struct filter *f);
+	// write the contents to a checkpoint, or read them back into a
+	// filter initialized the same way; return 0 on success
+	int (*save)(const struct filter *f, FILE *out);
+	int (*load)(struct filter *f, FILE *in);
+	// add all keys of another filter of the same kind and setup,
+	// returns 0 on success; NULL for filters that can't be merged
+	int (*merge)(struct filter *f, const struct filter *other);
+	// make a filter kept in a file survive a crash as it is now, returns
+	// 0 on success; NULL for filters that can't be kept in a file (the
+	// growing ones)
+	int (*sync)(struct filter *f);
+	void (*free)(struct filter *f);
+};
+
+struct filter {
+	const struct filter_ops *ops;
+	// keys are key_bits long, padded with zeros to key_len bytes
+	unsigned int key_bits;
+	size_t key_len;
+	// the file the filter is kept in, or NULL, whether keys found there
+	// are kept (when resuming) or cleared, and whether init kept some
+	const char *path;
+	int keep;
+	int attached;
+	// filter specific state
+	void *priv;
+};
+
+// NULL terminated list of all filters, the first one is the default
+extern const struct filter_ops *const filter_backends[];
+
+// libbloom bloom filter, sized up front
+extern const struct filter_ops filter_bloom;
+// libbloom filters added as slices with tighter and tighter
+// false positive rates as the number of keys grows
+extern const struct filter_ops filter_scalable;
+// bloom filter keeping each key's bits in a single cache line
+extern const struct filter_ops filter_blocked;
+// quotient filter storing key prefixes, can grow and be merged
+extern const struct filter_ops filter_quotient;
+// the blocked filter with atomic bit sets, for sharing between threads
+extern const struct filter_ops filter_atomic;
+
+// returns the filter with the given name, or NULL
+const struct filter_ops *filter_find(const char *name);
+// keeps the filter in the file at path unless that's NULL, with the keys
+// a previous run left there if keep is set
+int filter_init(struct filter *f, const struct filter_ops *ops,
+		unsigned int key_bits, size_t capacity, double fpr, const char *path,
+		int keep);
+// for init: the filter's zeroed memory, from mem_alloc() or mapped from
+// f->path with the filter's name, key length and the n params describing
+// its layout in the file's header, cleared unless f->keep
+void *filter_alloc(struct filter *f, size_t bytes, const uint64_t *params,
+		size_t n);
+
+// batched probes of n keys stride bytes apart: prefetches them all, and
+// then checks them all, setting found[i] to 1 for the (probable) hits and
+// returning how many there were; the keys are checked against the filter
+// as it was before the batch, so add them one by one afterwards if keys
+// of the same batch could be equal
+void filter_prefetch_many(const struct filter *f, const void *keys,
+		size_t stride, size_t n);
+size_t filter_check_many(struct filter *f, const void *keys, size_t stride,
+		size_t n, unsigned char *found);
+
+#endif //FILTER_H
@@ -0,0 +1,214 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "filter_block.h"
+#include "mem.h"
+
+// Blocked bloom filter that any number of threads can check and add to at
+// once: the same layout as the blocked filter, eight bits of a key in the
+// eight 64-bit words of one cache line, but the bits are set with atomic
+// fetch-or. test_and_add() reads the line first and only writes the words
+// still missing their bit, so a key that's (probably) there already never
+// dirties the line and a new one costs a single round trip to it.
+
+
+struct atomic_filter {
+	_Atomic uint64_t *blocks;
+	size_t num_blocks;
+	size_t capacity;
+	atomic_size_t count;
+};
+
+static _Atomic uint64_t *atomic_line(const struct atomic_filter *a, uint64_t x) {
+	return a->blocks + block_index(x, a->num_blocks);
+}
+
+
+static int atomic_init_filter(struct filter *f, size_t capacity, double fpr) {
+	struct atomic_filter *a = calloc(1, sizeof(*a));
+
+	if (a == NULL) {
+		return 1;
+	}
+
+	a->num_blocks = block_count(capacity, fpr);
+	a->capacity = capacity;
+	atomic_init(&a->count, 0);
+
+	size_t bytes = a->num_blocks * BLOCK_WORDS * sizeof(*a->blocks);
+	uint64_t layout[] = { a->num_blocks, a->capacity };
+	a->blocks = filter_alloc(f, bytes, layout, 2);
+	if (a->blocks == NULL) {
+		printf("Failed to init atomic filter! Tried to allocate %.2f MB.\n",
+				(double) bytes / 1024 / 1024);
+		free(a);
+		return 1;
+	}
+	if (f->attached) {
+		size_t count;
+
+		memcpy(&count, mem_file_state((void *) a->blocks), sizeof(count));
+		atomic_store(&a->count, count);
+	} else {
+		for (size_t i = 0; i < a->num_blocks * BLOCK_WORDS; i++) {
+			atomic_init(&a->blocks[i], 0);
+		}
+	}
+
+	f->priv = a;
+	return 0;
+}
+
+static int atomic_check(struct filter *f, const void *key) {
+	struct atomic_filter *a = f->priv;
+	uint64_t x = block_key(f->key_len, key);
+	_Atomic uint64_t *line = atomic_line(a, x);
+
+	for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+		uint64_t bit = block_bit(x, i);
+
+		if (!(atomic_load_explicit(&line[i], memory_order_relaxed) & bit)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int atomic_test_and_add(struct filter *f, const void *key, int *full) {
+	struct atomic_filter *a = f->priv;
+	uint64_t x = block_key(f->key_len, key);
+	_Atomic uint64_t *line = atomic_line(a, x);
+	uint64_t bits[BLOCK_WORDS], seen[BLOCK_WORDS];
+	int present = 1;
+
+	*full = 0;
+	for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+		bits[i] = block_bit(x, i);
+		seen[i] = atomic_load_explicit(&line[i], memory_order_relaxed);
+		present &= (seen[i] & bits[i]) != 0;
+	}
+	if (present) {
+		return 1;
+	}
+
+	// if any of the missing bits got set by another thread in the meantime
+	// it may be adding the same key, so one of the two has to say it's
+	// there: whoever's fetch-or comes second sees the other's bit
+	for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+		if (!(seen[i] & bits[i]) && (atomic_fetch_or_explicit(&line[i], bits[i],
+				memory_order_relaxed) & bits[i])) {
+			present = 1;
+		}
+	}
+	if (!present) {
+		*full = atomic_fetch_add_explicit(&a->count, 1, memory_order_relaxed) + 1 >=
+				a->capacity;
+	}
+
+	return present;
+}
+
+static int atomic_add(struct filter *f, const void *key) {
+	int full;
+
+	atomic_test_and_add(f, key, &full);
+	return full;
+}
+
+static void atomic_prefetch(const struct filter *f, const void *key) {
+	const struct atomic_filter *a = f->priv;
+
+	// for writing, most keys are new
+	__builtin_prefetch((const void *) atomic_line(a, block_key(f->key_len, key)), 1);
+}
+
+static size_t atomic_bytes(const struct filter *f) {
+	const struct atomic_filter *a = f->priv;
+
+	return a->num_blocks * BLOCK_WORDS * sizeof(*a->blocks);
+}
+
+static double atomic_fill(const struct filter *f) {
+	const struct atomic_filter *a = f->priv;
+	size_t words = a->num_blocks * BLOCK_WORDS;
+	size_t set = 0;
+
+	for (size_t i = 0; i < words; i++) {
+		set += __builtin_popcountll(atomic_load_explicit(&a->blocks[i],
+				memory_order_relaxed));
+	}
+
+	return (double) set / (64.0 * words);
+}
+
+// saving and loading happen with no other threads around, so the words
+// are copied as plain memory
+
+static int atomic_save(const struct filter *f, FILE *out) {
+	const struct atomic_filter *a = f->priv;
+	size_t count = atomic_load(&a->count);
+
+	return fwrite(&count, sizeof(count), 1, out) != 1 ||
+			fwrite(&a->num_blocks, sizeof(a->num_blocks), 1, out) != 1 ||
+			fwrite((const void *) a->blocks, atomic_bytes(f), 1, out) != 1;
+}
+
+static int atomic_load_filter(struct filter *f, FILE *in) {
+	struct atomic_filter *a = f->priv;
+	size_t count, num_blocks;
+
+	if (fread(&count, sizeof(count), 1, in) != 1 ||
+			fread(&num_blocks, sizeof(num_blocks), 1, in) != 1 ||
+			num_blocks != a->num_blocks ||
+			fread((void *) a->blocks, atomic_bytes(f), 1, in) != 1) {
+		return 1;
+	}
+	atomic_store(&a->count, count);
+
+	return 0;
+}
+
+static void atomic_keep_count(struct atomic_filter *a) {
+	// into the header of the file the filter is kept in, if any
+	void *state = mem_file_state((void *) a->blocks);
+	size_t count = atomic_load(&a->count);
+
+	if (state != NULL) {
+		memcpy(state, &count, sizeof(count));
+	}
+}
+
+static int atomic_sync(struct filter *f) {
+	struct atomic_filter *a = f->priv;
+
+	atomic_keep_count(a);
+	return mem_sync((void *) a->blocks);
+}
+
+static void atomic_free(struct filter *f) {
+	struct atomic_filter *a = f->priv;
+
+	atomic_keep_count(a);
+	mem_free((void *) a->blocks);
+	free(a);
+	f->priv = NULL;
+}
+
+const struct filter_ops filter_atomic = {
+	.name = "atomic",
+	.description = "cache line blocked bloom filter threads can share",
+	.init = atomic_init_filter,
+	.check = atomic_check,
+	.add = atomic_add,
+	.test_and_add = atomic_test_and_add,
+	.prefetch = atomic_prefetch,
+	.bytes = atomic_bytes,
+	.fill = atomic_fill,
+	.save = atomic_save,
+	.load = atomic_load_filter,
+	.sync = atomic_sync,
+	.free = atomic_free,
+};
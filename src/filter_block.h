@@ -0,0 +1,77 @@
+#ifndef FILTER_BLOCK_H
+#define FILTER_BLOCK_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Layout shared by the blocked and atomic filters: all bits of a key live
+// in one 64-byte line, one bit in each of its eight 64-bit words. Keys are
+// uniformly random hash prefixes, so nothing gets hashed: the line comes
+// from the key's top bits and the bit positions from multiply-shift of its
+// low 32 bits with eight odd salts. Keys shorter than 64 bits (trimmed to
+// whole bytes, with zeros at the end) are spread over the whole word with
+// a single multiplication first.
+
+#define BLOCK_WORDS 8
+#define BLOCK_BITS (BLOCK_WORDS * 64)
+// bits per key are raised in these steps until the target rate is met
+#define BITS_PER_KEY_STEP 0.25
+#define MAX_BITS_PER_KEY 64
+
+static const uint32_t block_salts[BLOCK_WORDS] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+
+static inline uint64_t block_key(size_t key_len, const void *key) {
+	uint64_t x = 0;
+
+	memcpy(&x, key, key_len < sizeof(x) ? key_len : sizeof(x));
+	if (key_len < sizeof(x)) {
+		x *= 0x9e3779b97f4a7c15ULL;
+	}
+
+	return x;
+}
+
+static inline double block_fpr(double keys_per_block) {
+	// chance that all eight bits are set already, with the number of
+	// keys in a block Poisson distributed
+	double p = exp(-keys_per_block);
+	double fpr = 0;
+
+	for (unsigned int j = 0; j < 4 * keys_per_block + 64; j++) {
+		fpr += p * pow(1 - pow(1 - 1.0 / 64, j), BLOCK_WORDS);
+		p *= keys_per_block / (j + 1);
+	}
+
+	return fpr;
+}
+
+// number of lines for capacity keys at a false positive rate of fpr
+static inline size_t block_count(size_t capacity, double fpr) {
+	// starting at one bit per key keeps exp() in block_fpr() from underflowing
+	double bpk = 1;
+
+	while (bpk < MAX_BITS_PER_KEY && block_fpr(BLOCK_BITS / bpk) > fpr) {
+		bpk += BITS_PER_KEY_STEP;
+	}
+
+	return ceil(capacity * bpk / BLOCK_BITS);
+}
+
+// first word of the key's line: multiply-shift maps the top 32 bits onto
+// the lines evenly
+static inline size_t block_index(uint64_t x, size_t num_blocks) {
+	return (((x >> 32) * num_blocks) >> 32) * BLOCK_WORDS;
+}
+
+// the key's bit in word i of its line
+static inline uint64_t block_bit(uint32_t lo, unsigned int i) {
+	return 1ULL << ((uint32_t) (lo * block_salts[i]) >> 26);
+}
+
+#endif //FILTER_BLOCK_H
@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "filter_block.h"
+#include "mem.h"
+#include "sha256_x86.h"
+
+#if defined SHA256_HAVE_X86
+#include <immintrin.h>
+#endif
+
+// Cache-line-blocked bloom filter: all bits of a key live in one 64-byte
+// line, one bit in each of its eight 64-bit words, so a probe costs a
+// single cache miss and the eight bits are tested with one SIMD compare.
+// The layout (see filter_block.h) is shared with the atomic filter.
+
+
+struct blocked_filter {
+	uint64_t *blocks;
+	size_t num_blocks;
+	size_t capacity;
+	size_t count;
+	int (*check)(const uint64_t *block, uint32_t lo);
+	void (*add)(uint64_t *block, uint32_t lo);
+};
+
+static int check_scalar(const uint64_t *block, uint32_t lo) {
+	for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+		if (!(block[i] & block_bit(lo, i))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void add_scalar(uint64_t *block, uint32_t lo) {
+	for (unsigned int i = 0; i < BLOCK_WORDS; i++) {
+		block[i] |= block_bit(lo, i);
+	}
+}
+
+#if defined SHA256_HAVE_X86
+
+// mul_epu32 gives the full 64-bit products of the low halves, bits 26 to
+// 31 of those are the bit positions
+
+__attribute__((target("avx2")))
+static __m256i mask_avx2(uint32_t lo, const uint32_t *s) {
+	__m256i pos = _mm256_mul_epu32(_mm256_set1_epi64x(lo),
+			_mm256_setr_epi64x(s[0], s[1], s[2], s[3]));
+
+	pos = _mm256_and_si256(_mm256_srli_epi64(pos, 26), _mm256_set1_epi64x(63));
+	return _mm256_sllv_epi64(_mm256_set1_epi64x(1), pos);
+}
+
+__attribute__((target("avx2")))
+static int check_avx2(const uint64_t *block, uint32_t lo) {
+	__m256i a = _mm256_load_si256((const __m256i *) block);
+	__m256i b = _mm256_load_si256((const __m256i *) block + 1);
+
+	return _mm256_testc_si256(a, mask_avx2(lo, block_salts)) &
+			_mm256_testc_si256(b, mask_avx2(lo, block_salts + 4));
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(uint64_t *block, uint32_t lo) {
+	__m256i *v = (__m256i *) block;
+
+	_mm256_store_si256(v, _mm256_or_si256(_mm256_load_si256(v),
+			mask_avx2(lo, block_salts)));
+	_mm256_store_si256(v + 1, _mm256_or_si256(_mm256_load_si256(v + 1),
+			mask_avx2(lo, block_salts + 4)));
+}
+
+__attribute__((target("avx512f")))
+static __m512i mask_avx512(uint32_t lo) {
+	__m512i pos = _mm512_mul_epu32(_mm512_set1_epi64(lo),
+			_mm512_setr_epi64(block_salts[0], block_salts[1], block_salts[2],
+					block_salts[3], block_salts[4], block_salts[5],
+					block_salts[6], block_salts[7]));
+
+	pos = _mm512_and_si512(_mm512_srli_epi64(pos, 26), _mm512_set1_epi64(63));
+	return _mm512_sllv_epi64(_mm512_set1_epi64(1), pos);
+}
+
+__attribute__((target("avx512f")))
+static int check_avx512(const uint64_t *block, uint32_t lo) {
+	__m512i mask = mask_avx512(lo);
+
+	// any mask bits the line doesn't have?
+	return _mm512_test_epi64_mask(_mm512_andnot_si512(
+			_mm512_load_si512(block), mask), mask) == 0;
+}
+
+__attribute__((target("avx512f")))
+static void add_avx512(uint64_t *block, uint32_t lo) {
+	_mm512_store_si512(block, _mm512_or_si512(_mm512_load_si512(block),
+			mask_avx512(lo)));
+}
+
+#endif
+
+
+static int blocked_init(struct filter *f, size_t capacity, double fpr) {
+	struct blocked_filter *b = calloc(1, sizeof(*b));
+
+	if (b == NULL) {
+		return 1;
+	}
+
+	b->num_blocks = block_count(capacity, fpr);
+	b->capacity = capacity;
+
+	size_t bytes = b->num_blocks * BLOCK_WORDS * sizeof(*b->blocks);
+	uint64_t layout[] = { b->num_blocks, b->capacity };
+	b->blocks = filter_alloc(f, bytes, layout, 2);
+	if (b->blocks == NULL) {
+		printf("Failed to init blocked filter! Tried to allocate %.2f MB.\n",
+				(double) bytes / 1024 / 1024);
+		free(b);
+		return 1;
+	}
+	if (f->attached) {
+		memcpy(&b->count, mem_file_state(b->blocks), sizeof(b->count));
+	}
+
+	b->check = check_scalar;
+	b->add = add_scalar;
+#if defined SHA256_HAVE_X86
+	if (sha256_x86_has_avx512()) {
+		b->check = check_avx512;
+		b->add = add_avx512;
+	} else if (sha256_x86_has_avx2()) {
+		b->check = check_avx2;
+		b->add = add_avx2;
+	}
+#endif
+
+	f->priv = b;
+	return 0;
+}
+
+static uint64_t *blocked_line(const struct blocked_filter *b, uint64_t x) {
+	return b->blocks + block_index(x, b->num_blocks);
+}
+
+static int blocked_check(struct filter *f, const void *key) {
+	struct blocked_filter *b = f->priv;
+	uint64_t x = block_key(f->key_len, key);
+
+	return b->check(blocked_line(b, x), x);
+}
+
+static int blocked_add(struct filter *f, const void *key) {
+	struct blocked_filter *b = f->priv;
+	uint64_t x = block_key(f->key_len, key);
+
+	b->add(blocked_line(b, x), x);
+	// sized up front, like the plain bloom filter
+	return ++b->count >= b->capacity;
+}
+
+static void blocked_prefetch(const struct filter *f, const void *key) {
+	const struct blocked_filter *b = f->priv;
+
+	__builtin_prefetch(blocked_line(b, block_key(f->key_len, key)));
+}
+
+static size_t blocked_bytes(const struct filter *f) {
+	const struct blocked_filter *b = f->priv;
+
+	return b->num_blocks * BLOCK_WORDS * sizeof(*b->blocks);
+}
+
+static double blocked_fill(const struct filter *f) {
+	const struct blocked_filter *b = f->priv;
+	size_t words = b->num_blocks * BLOCK_WORDS;
+	size_t set = 0;
+
+	for (size_t i = 0; i < words; i++) {
+		set += __builtin_popcountll(b->blocks[i]);
+	}
+
+	return (double) set / (64.0 * words);
+}
+
+static int blocked_save(const struct filter *f, FILE *out) {
+	const struct blocked_filter *b = f->priv;
+
+	return fwrite(&b->count, sizeof(b->count), 1, out) != 1 ||
+			fwrite(&b->num_blocks, sizeof(b->num_blocks), 1, out) != 1 ||
+			fwrite(b->blocks, blocked_bytes(f), 1, out) != 1;
+}
+
+static int blocked_load(struct filter *f, FILE *in) {
+	struct blocked_filter *b = f->priv;
+	size_t num_blocks;
+
+	return fread(&b->count, sizeof(b->count), 1, in) != 1 ||
+			fread(&num_blocks, sizeof(num_blocks), 1, in) != 1 ||
+			num_blocks != b->num_blocks ||
+			fread(b->blocks, blocked_bytes(f), 1, in) != 1;
+}
+
+static int blocked_sync(struct filter *f) {
+	struct blocked_filter *b = f->priv;
+	void *state = mem_file_state(b->blocks);
+
+	// the bits are in the file already, the count goes into its header
+	if (state != NULL) {
+		memcpy(state, &b->count, sizeof(b->count));
+	}
+	return mem_sync(b->blocks);
+}
+
+static void blocked_free(struct filter *f) {
+	struct blocked_filter *b = f->priv;
+	void *state = mem_file_state(b->blocks);
+
+	if (state != NULL) {
+		memcpy(state, &b->count, sizeof(b->count));
+	}
+	mem_free(b->blocks);
+	free(b);
+	f->priv = NULL;
+}
+
+const struct filter_ops filter_blocked = {
+	.name = "blocked",
+	.description = "bloom filter with each key in one cache line, SIMD probes",
+	.init = blocked_init,
+	.check = blocked_check,
+	.add = blocked_add,
+	.prefetch = blocked_prefetch,
+	.bytes = blocked_bytes,
+	.fill = blocked_fill,
+	.save = blocked_save,
+	.load = blocked_load,
+	.sync = blocked_sync,
+	.free = blocked_free,
+};
@@ -0,0 +1,360 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "mem.h"
+#include "libbloom/bloom.h"
+
+// Bloom filters from libbloom, either one sized for the whole run or a
+// scalable one (Almeida et al.) that starts small and adds slices as it
+// fills up. Every slice gets twice the capacity and half the false positive
+// rate of the one before, so the rates add up to at most the requested one
+// no matter how many slices there end up being.
+
+// the scalable filter's first slice holds at most this many keys
+#define SCALABLE_FIRST_ELEMS (1UL << 20)
+#define SCALABLE_MAX_SLICES 32
+#define SCALABLE_GROWTH 2
+#define SCALABLE_TIGHTENING 0.5
+
+
+struct bloom_filter {
+	struct bloom bloom;
+	size_t capacity;
+	size_t count;
+};
+
+struct scalable_filter {
+	struct bloom slices[SCALABLE_MAX_SLICES];
+	unsigned int num_slices;
+	// keys in the newest slice, which is the only one still added to
+	size_t count;
+	size_t capacity;
+	double fpr;
+};
+
+
+static int bloom_slice_init(struct bloom *b, size_t capacity, double fpr) {
+	if (bloom_init(b, capacity, fpr)) {
+		printf("Failed to init bloom filter! Tried to allocate %.2f MB.\n",
+				(double) b->bytes / 1024 / 1024);
+		bloom_print(b);
+		return 1;
+	}
+
+	return 0;
+}
+
+static size_t bloom_slice_set_bits(const struct bloom *b) {
+	const unsigned char *bf = b->bf;
+	size_t set = 0;
+	int i = 0;
+
+	for (; i + (int) sizeof(uint64_t) <= b->bytes; i += sizeof(uint64_t)) {
+		uint64_t w;
+
+		memcpy(&w, bf + i, sizeof(w));
+		set += __builtin_popcountll(w);
+	}
+	for (; i < b->bytes; i++) {
+		set += __builtin_popcount(bf[i]);
+	}
+
+	return set;
+}
+
+static int bloom_slice_save(const struct bloom *b, FILE *out) {
+	return fwrite(&b->entries, sizeof(b->entries), 1, out) != 1 ||
+			fwrite(&b->error, sizeof(b->error), 1, out) != 1 ||
+			fwrite(b->bf, b->bytes, 1, out) != 1;
+}
+
+static int bloom_slice_load(struct bloom *b, FILE *in) {
+	// the slice has to be set up the same way it was saved
+	int entries;
+	double error;
+
+	if (fread(&entries, sizeof(entries), 1, in) != 1 ||
+			fread(&error, sizeof(error), 1, in) != 1) {
+		return 1;
+	}
+	if (!b->ready) {
+		if (bloom_init(b, entries, error)) {
+			return 1;
+		}
+		mem_advise(b->bf, b->bytes);
+	}
+	if (b->entries != entries || b->error != error) {
+		return 1;
+	}
+
+	return fread(b->bf, b->bytes, 1, in) != 1;
+}
+
+
+static int bloom_filter_init(struct filter *f, size_t capacity, double fpr) {
+	struct bloom_filter *b = calloc(1, sizeof(*b));
+
+	if (b == NULL) {
+		return 1;
+	}
+	if (bloom_slice_init(&b->bloom, capacity, fpr)) {
+		free(b);
+		return 1;
+	}
+	b->capacity = capacity;
+
+	if (f->path == NULL) {
+		// libbloom callocs the bits, they're only touched once keys come in
+		mem_advise(b->bloom.bf, b->bloom.bytes);
+	} else {
+		// libbloom's bits are swapped for the file's, and back to
+		// NULL before bloom_free()
+		uint64_t layout[] = { b->bloom.entries, b->bloom.bytes, 0 };
+		unsigned char *bits;
+
+		memcpy(&layout[2], &b->bloom.error, sizeof(layout[2]));
+		bits = filter_alloc(f, b->bloom.bytes, layout, 3);
+		if (bits == NULL) {
+			bloom_free(&b->bloom);
+			free(b);
+			return 1;
+		}
+		free(b->bloom.bf);
+		b->bloom.bf = bits;
+		if (f->attached) {
+			memcpy(&b->count, mem_file_state(bits), sizeof(b->count));
+		}
+	}
+
+	f->priv = b;
+	return 0;
+}
+
+static int bloom_filter_check(struct filter *f, const void *key) {
+	struct bloom_filter *b = f->priv;
+
+	return bloom_check(&b->bloom, key, f->key_len) == 1;
+}
+
+static int bloom_filter_add(struct filter *f, const void *key) {
+	struct bloom_filter *b = f->priv;
+
+	bloom_add(&b->bloom, key, f->key_len);
+	// continuing would drastically increase false-positive rate
+	return ++b->count >= b->capacity;
+}
+
+static size_t bloom_filter_bytes(const struct filter *f) {
+	const struct bloom_filter *b = f->priv;
+
+	return b->bloom.bytes;
+}
+
+static double bloom_filter_fill(const struct filter *f) {
+	const struct bloom_filter *b = f->priv;
+
+	return (double) bloom_slice_set_bits(&b->bloom) / (8.0 * b->bloom.bytes);
+}
+
+static int bloom_filter_save(const struct filter *f, FILE *out) {
+	const struct bloom_filter *b = f->priv;
+
+	return fwrite(&b->count, sizeof(b->count), 1, out) != 1 ||
+			bloom_slice_save(&b->bloom, out);
+}
+
+static int bloom_filter_load(struct filter *f, FILE *in) {
+	struct bloom_filter *b = f->priv;
+
+	return fread(&b->count, sizeof(b->count), 1, in) != 1 ||
+			bloom_slice_load(&b->bloom, in);
+}
+
+static int bloom_filter_sync(struct filter *f) {
+	struct bloom_filter *b = f->priv;
+	void *state = mem_file_state(b->bloom.bf);
+
+	// the bits are in the file already, the count goes into its header
+	if (state != NULL) {
+		memcpy(state, &b->count, sizeof(b->count));
+	}
+	return mem_sync(b->bloom.bf);
+}
+
+static void bloom_filter_free(struct filter *f) {
+	struct bloom_filter *b = f->priv;
+	void *state = mem_file_state(b->bloom.bf);
+
+	if (state != NULL) {
+		memcpy(state, &b->count, sizeof(b->count));
+		mem_free(b->bloom.bf);
+		b->bloom.bf = NULL;
+	}
+	mem_forget(b->bloom.bf);
+	bloom_free(&b->bloom);
+	free(b);
+	f->priv = NULL;
+}
+
+
+static int scalable_init(struct filter *f, size_t capacity, double fpr) {
+	struct scalable_filter *s = calloc(1, sizeof(*s));
+
+	if (s == NULL) {
+		return 1;
+	}
+
+	s->capacity = capacity < SCALABLE_FIRST_ELEMS ? capacity : SCALABLE_FIRST_ELEMS;
+	s->fpr = fpr * (1 - SCALABLE_TIGHTENING);
+	if (bloom_slice_init(&s->slices[0], s->capacity, s->fpr)) {
+		free(s);
+		return 1;
+	}
+	mem_advise(s->slices[0].bf, s->slices[0].bytes);
+	s->num_slices = 1;
+
+	f->priv = s;
+	return 0;
+}
+
+static int scalable_check(struct filter *f, const void *key) {
+	struct scalable_filter *s = f->priv;
+
+	// the newest slice is the biggest one, most hits are there
+	for (unsigned int i = s->num_slices; i > 0; i--) {
+		if (bloom_check(&s->slices[i - 1], key, f->key_len) == 1) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int scalable_add(struct filter *f, const void *key) {
+	struct scalable_filter *s = f->priv;
+
+	if (s->count >= s->capacity) {
+		if (s->num_slices == SCALABLE_MAX_SLICES) {
+			return 1;
+		}
+		s->capacity *= SCALABLE_GROWTH;
+		s->fpr *= SCALABLE_TIGHTENING;
+		if (bloom_slice_init(&s->slices[s->num_slices], s->capacity, s->fpr)) {
+			return 1;
+		}
+		mem_advise(s->slices[s->num_slices].bf, s->slices[s->num_slices].bytes);
+		s->num_slices++;
+		s->count = 0;
+#ifdef DEBUG
+		printf("Added bloom filter slice %u for %zu elems @ %g FP probability.\n",
+				s->num_slices, s->capacity, s->fpr);
+#endif
+	}
+
+	bloom_add(&s->slices[s->num_slices - 1], key, f->key_len);
+	s->count++;
+	return 0;
+}
+
+static size_t scalable_bytes(const struct filter *f) {
+	const struct scalable_filter *s = f->priv;
+	size_t bytes = 0;
+
+	for (unsigned int i = 0; i < s->num_slices; i++) {
+		bytes += s->slices[i].bytes;
+	}
+
+	return bytes;
+}
+
+static double scalable_fill(const struct filter *f) {
+	const struct scalable_filter *s = f->priv;
+	size_t set = 0;
+
+	for (unsigned int i = 0; i < s->num_slices; i++) {
+		set += bloom_slice_set_bits(&s->slices[i]);
+	}
+
+	return (double) set / (8.0 * scalable_bytes(f));
+}
+
+static int scalable_save(const struct filter *f, FILE *out) {
+	const struct scalable_filter *s = f->priv;
+
+	if (fwrite(&s->num_slices, sizeof(s->num_slices), 1, out) != 1 ||
+			fwrite(&s->count, sizeof(s->count), 1, out) != 1 ||
+			fwrite(&s->capacity, sizeof(s->capacity), 1, out) != 1 ||
+			fwrite(&s->fpr, sizeof(s->fpr), 1, out) != 1) {
+		return 1;
+	}
+	for (unsigned int i = 0; i < s->num_slices; i++) {
+		if (bloom_slice_save(&s->slices[i], out)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int scalable_load(struct filter *f, FILE *in) {
+	struct scalable_filter *s = f->priv;
+	unsigned int num_slices;
+
+	if (fread(&num_slices, sizeof(num_slices), 1, in) != 1 ||
+			num_slices < 1 || num_slices > SCALABLE_MAX_SLICES ||
+			fread(&s->count, sizeof(s->count), 1, in) != 1 ||
+			fread(&s->capacity, sizeof(s->capacity), 1, in) != 1 ||
+			fread(&s->fpr, sizeof(s->fpr), 1, in) != 1) {
+		return 1;
+	}
+
+	// the first slice is already there, the others get set up as they're read
+	for (unsigned int i = 0; i < num_slices; i++) {
+		s->num_slices = i + 1;
+		if (bloom_slice_load(&s->slices[i], in)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void scalable_free(struct filter *f) {
+	struct scalable_filter *s = f->priv;
+
+	for (unsigned int i = 0; i < s->num_slices; i++) {
+		mem_forget(s->slices[i].bf);
+		bloom_free(&s->slices[i]);
+	}
+	free(s);
+	f->priv = NULL;
+}
+
+
+const struct filter_ops filter_bloom = {
+	.name = "bloom",
+	.description = "libbloom bloom filter sized for the whole run",
+	.init = bloom_filter_init,
+	.check = bloom_filter_check,
+	.add = bloom_filter_add,
+	.bytes = bloom_filter_bytes,
+	.fill = bloom_filter_fill,
+	.save = bloom_filter_save,
+	.load = bloom_filter_load,
+	.sync = bloom_filter_sync,
+	.free = bloom_filter_free,
+};
+
+const struct filter_ops filter_scalable = {
+	.name = "scalable",
+	.description = "bloom filter growing in slices as needed (default)",
+	.init = scalable_init,
+	.check = scalable_check,
+	.add = scalable_add,
+	.bytes = scalable_bytes,
+	.fill = scalable_fill,
+	.save = scalable_save,
+	.load = scalable_load,
+	.free = scalable_free,
+};
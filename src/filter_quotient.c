@@ -0,0 +1,435 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "mem.h"
+
+// Quotient filter (Bender et al.): a key's fingerprint is simply its first
+// fp_bits bits, no hashing needed as keys are random hash prefixes. The top
+// qbits of the fingerprint pick a slot and the rest (the remainder) is
+// stored there, or in the run of slots following it, with three metadata
+// bits per slot to tell which slot a remainder belongs to. Lookups only
+// fail to tell keys apart when their whole fingerprints agree, so with
+// fp_bits chosen for the wanted rate at full capacity false positives are
+// much rarer for most of the run, and none at all once the fingerprint
+// covers the whole key. Unlike bloom filters it can be resized (moving a
+// remainder bit into the quotient) and two of them can be merged, both
+// just by reinserting the fingerprints.
+
+// slots of the first table, it doubles whenever it's too full
+#define QF_FIRST_QBITS 16
+// every bit of fingerprint halves the false positives at the cost of one
+// bit per slot, so aim this much below the requested rate; that's about
+// the memory of a bloom filter at the requested rate
+#define QF_FPR_FACTOR 100
+#define QF_MAX_LOAD 0.75
+
+#define QF_OCCUPIED 1
+#define QF_CONTINUATION 2
+#define QF_SHIFTED 4
+#define QF_META_BITS 3
+
+#define MASK(bits) ((bits) >= 64 ? ~0ULL : (1ULL << (bits)) - 1)
+
+
+struct quotient_filter {
+	uint64_t *words;
+	size_t bytes;
+	size_t slots;
+	size_t used;
+	unsigned int qbits;
+	unsigned int rbits;
+	unsigned int slot_bits;
+	// qbits + rbits, stays the same when resizing
+	unsigned int fp_bits;
+};
+
+
+static inline uint64_t slot_read(const struct quotient_filter *qf, size_t i) {
+	size_t bit = i * qf->slot_bits;
+	size_t word = bit / 64;
+	unsigned int off = bit % 64;
+	uint64_t v = qf->words[word] >> off;
+
+	if (off + qf->slot_bits > 64) {
+		v |= qf->words[word + 1] << (64 - off);
+	}
+
+	return v & MASK(qf->slot_bits);
+}
+
+static inline void slot_write(struct quotient_filter *qf, size_t i, uint64_t v) {
+	size_t bit = i * qf->slot_bits;
+	size_t word = bit / 64;
+	unsigned int off = bit % 64;
+	uint64_t mask = MASK(qf->slot_bits);
+
+	qf->words[word] = (qf->words[word] & ~(mask << off)) | (v << off);
+	if (off + qf->slot_bits > 64) {
+		unsigned int spill = 64 - off;
+		qf->words[word + 1] = (qf->words[word + 1] & ~(mask >> spill)) | (v >> spill);
+	}
+}
+
+static inline size_t incr(const struct quotient_filter *qf, size_t i) {
+	return (i + 1) & (qf->slots - 1);
+}
+
+static inline size_t decr(const struct quotient_filter *qf, size_t i) {
+	return (i - 1) & (qf->slots - 1);
+}
+
+static int qf_alloc(struct quotient_filter *qf, unsigned int qbits,
+		unsigned int fp_bits) {
+	qf->qbits = qbits;
+	qf->rbits = fp_bits - qbits;
+	qf->fp_bits = fp_bits;
+	qf->slot_bits = qf->rbits + QF_META_BITS;
+	qf->slots = (size_t) 1 << qbits;
+	qf->used = 0;
+
+	// one more word so that reading the last slot never goes past the end
+	qf->bytes = ((qf->slots * qf->slot_bits + 63) / 64 + 1) * sizeof(uint64_t);
+	qf->words = mem_alloc(qf->bytes);
+
+	return qf->words == NULL;
+}
+
+static size_t find_run(const struct quotient_filter *qf, size_t fq) {
+	// back to the start of the cluster, then forward run by run (one
+	// for each occupied quotient) until the one belonging to fq
+	size_t b = fq, s;
+
+	while (slot_read(qf, b) & QF_SHIFTED) {
+		b = decr(qf, b);
+	}
+
+	s = b;
+	while (b != fq) {
+		do {
+			s = incr(qf, s);
+		} while (slot_read(qf, s) & QF_CONTINUATION);
+		do {
+			b = incr(qf, b);
+		} while (!(slot_read(qf, b) & QF_OCCUPIED));
+	}
+
+	return s;
+}
+
+static int qf_contains(const struct quotient_filter *qf, uint64_t fp) {
+	size_t fq = fp >> qf->rbits;
+	uint64_t fr = fp & MASK(qf->rbits);
+
+	if (!(slot_read(qf, fq) & QF_OCCUPIED)) {
+		return 0;
+	}
+
+	// runs are kept sorted
+	size_t s = find_run(qf, fq);
+	do {
+		uint64_t rem = slot_read(qf, s) >> QF_META_BITS;
+
+		if (rem == fr) {
+			return 1;
+		} else if (rem > fr) {
+			return 0;
+		}
+		s = incr(qf, s);
+	} while (slot_read(qf, s) & QF_CONTINUATION);
+
+	return 0;
+}
+
+static void shift_in(struct quotient_filter *qf, size_t s, uint64_t elem) {
+	// put elem at s and move everything up to the next empty slot one
+	// to the right; occupied bits belong to the slots, not the remainders
+	uint64_t prev;
+
+	for (;;) {
+		prev = slot_read(qf, s);
+		if ((prev & (QF_OCCUPIED | QF_CONTINUATION | QF_SHIFTED)) == 0) {
+			slot_write(qf, s, elem);
+			return;
+		}
+
+		prev |= QF_SHIFTED;
+		if (prev & QF_OCCUPIED) {
+			elem |= QF_OCCUPIED;
+			prev &= ~(uint64_t) QF_OCCUPIED;
+		} else {
+			elem &= ~(uint64_t) QF_OCCUPIED;
+		}
+		slot_write(qf, s, elem);
+		elem = prev;
+		s = incr(qf, s);
+	}
+}
+
+static void qf_insert(struct quotient_filter *qf, uint64_t fp) {
+	size_t fq = fp >> qf->rbits;
+	uint64_t fr = fp & MASK(qf->rbits);
+	uint64_t canonical = slot_read(qf, fq);
+	uint64_t elem = fr << QF_META_BITS;
+
+	if ((canonical & (QF_OCCUPIED | QF_CONTINUATION | QF_SHIFTED)) == 0) {
+		slot_write(qf, fq, elem | QF_OCCUPIED);
+		qf->used++;
+		return;
+	}
+
+	if (!(canonical & QF_OCCUPIED)) {
+		slot_write(qf, fq, canonical | QF_OCCUPIED);
+	}
+
+	size_t start = find_run(qf, fq);
+	size_t s = start;
+
+	if (canonical & QF_OCCUPIED) {
+		// find the place in the (sorted) run
+		do {
+			uint64_t rem = slot_read(qf, s) >> QF_META_BITS;
+
+			if (rem == fr) {
+				return;
+			} else if (rem > fr) {
+				break;
+			}
+			s = incr(qf, s);
+		} while (slot_read(qf, s) & QF_CONTINUATION);
+
+		if (s == start) {
+			// the old head of the run becomes a continuation
+			slot_write(qf, start, slot_read(qf, start) | QF_CONTINUATION);
+		} else {
+			elem |= QF_CONTINUATION;
+		}
+	}
+
+	if (s != fq) {
+		elem |= QF_SHIFTED;
+	}
+
+	shift_in(qf, s, elem);
+	qf->used++;
+}
+
+static size_t qf_cluster_start(const struct quotient_filter *qf) {
+	for (size_t i = 0; i < qf->slots; i++) {
+		uint64_t elem = slot_read(qf, i);
+
+		if ((elem & QF_OCCUPIED) && !(elem & (QF_CONTINUATION | QF_SHIFTED))) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+static int qf_copy(const struct quotient_filter *src,
+		int (*insert)(void *arg, uint64_t fp), void *arg) {
+	// walk all fingerprints of src in slot order, starting at a cluster
+	// so the quotient of every run is known
+	size_t i = qf_cluster_start(src);
+	size_t fq = i;
+	size_t seen = 0;
+
+	while (seen < src->used) {
+		uint64_t elem = slot_read(src, i);
+
+		if ((elem & QF_OCCUPIED) && !(elem & (QF_CONTINUATION | QF_SHIFTED))) {
+			// cluster start, the run is in its canonical slot
+			fq = i;
+		} else if (!(elem & QF_CONTINUATION) && (elem & (QF_OCCUPIED | QF_SHIFTED))) {
+			// start of the run of the next occupied quotient
+			do {
+				fq = incr(src, fq);
+			} while (!(slot_read(src, fq) & QF_OCCUPIED));
+		}
+
+		if (elem & (QF_OCCUPIED | QF_CONTINUATION | QF_SHIFTED)) {
+			uint64_t fp = ((uint64_t) fq << src->rbits) | (elem >> QF_META_BITS);
+
+			if (insert(arg, fp)) {
+				return 1;
+			}
+			seen++;
+		}
+		i = incr(src, i);
+	}
+
+	return 0;
+}
+
+static int qf_insert_arg(void *arg, uint64_t fp) {
+	qf_insert(arg, fp);
+	return 0;
+}
+
+static int qf_grow(struct quotient_filter *qf) {
+	// twice the slots, one bit less of remainder
+	struct quotient_filter bigger;
+
+	if (qf->rbits <= 1 || qf_alloc(&bigger, qf->qbits + 1, qf->fp_bits)) {
+		return 1;
+	}
+
+	qf_copy(qf, qf_insert_arg, &bigger);
+	mem_free(qf->words);
+	*qf = bigger;
+
+	return 0;
+}
+
+static int qf_add(void *arg, uint64_t fp) {
+	struct quotient_filter *qf = arg;
+
+	if (qf->used + 1 > qf->slots * QF_MAX_LOAD && qf_grow(qf)) {
+		return 1;
+	}
+
+	qf_insert(qf, fp);
+	return 0;
+}
+
+static uint64_t fingerprint(const struct filter *f, const void *key) {
+	// the first fp_bits bits of the key, big-endian
+	const struct quotient_filter *qf = f->priv;
+	const unsigned char *k = key;
+	uint64_t x = 0;
+
+	for (size_t i = 0; i < sizeof(x); i++) {
+		x = (x << 8) | (i < f->key_len ? k[i] : 0);
+	}
+
+	return x >> (64 - qf->fp_bits);
+}
+
+
+static int quotient_init(struct filter *f, size_t capacity, double fpr) {
+	struct quotient_filter *qf = calloc(1, sizeof(*qf));
+	unsigned int key_bits = f->key_bits < 64 ? f->key_bits : 64;
+	unsigned int fp_bits = 1;
+
+	if (qf == NULL) {
+		return 1;
+	}
+
+	// two keys share a fingerprint with chance 2^-fp_bits, so at
+	// capacity a lookup hits one of them with chance capacity / 2^fp_bits;
+	// once the fingerprint is the whole key there are no false positives
+	fpr /= QF_FPR_FACTOR;
+	while (fp_bits < key_bits && (double) capacity / ((uint64_t) 1 << fp_bits) > fpr) {
+		fp_bits++;
+	}
+
+	unsigned int qbits = QF_FIRST_QBITS < fp_bits - 1 ? QF_FIRST_QBITS : fp_bits - 1;
+	if (fp_bits < 2 || qf_alloc(qf, qbits, fp_bits)) {
+		printf("Failed to init quotient filter!\n");
+		free(qf);
+		return 1;
+	}
+
+	f->priv = qf;
+	return 0;
+}
+
+static int quotient_check(struct filter *f, const void *key) {
+	return qf_contains(f->priv, fingerprint(f, key));
+}
+
+static int quotient_add(struct filter *f, const void *key) {
+	return qf_add(f->priv, fingerprint(f, key));
+}
+
+static void quotient_prefetch(const struct filter *f, const void *key) {
+	// the home slot, its run is usually in the same line or the next
+	const struct quotient_filter *qf = f->priv;
+	size_t fq = fingerprint(f, key) >> qf->rbits;
+
+	__builtin_prefetch(&qf->words[fq * qf->slot_bits / 64]);
+}
+
+static size_t quotient_bytes(const struct filter *f) {
+	const struct quotient_filter *qf = f->priv;
+
+	return qf->bytes;
+}
+
+static double quotient_fill(const struct filter *f) {
+	const struct quotient_filter *qf = f->priv;
+
+	return (double) qf->used / qf->slots;
+}
+
+static int quotient_merge(struct filter *f, const struct filter *other) {
+	struct quotient_filter *qf = f->priv;
+	const struct quotient_filter *src = other->priv;
+
+	if (other->ops != f->ops || src->fp_bits != qf->fp_bits) {
+		return 1;
+	}
+
+	// make room first: the fingerprints come in sorted order, growing
+	// halfway through would leave the part already merged overfull and
+	// push one huge cluster along
+	while (qf->used + src->used > qf->slots * QF_MAX_LOAD) {
+		if (qf_grow(qf)) {
+			return 1;
+		}
+	}
+
+	return qf_copy(src, qf_add, qf);
+}
+
+static int quotient_save(const struct filter *f, FILE *out) {
+	const struct quotient_filter *qf = f->priv;
+
+	return fwrite(&qf->qbits, sizeof(qf->qbits), 1, out) != 1 ||
+			fwrite(&qf->fp_bits, sizeof(qf->fp_bits), 1, out) != 1 ||
+			fwrite(&qf->used, sizeof(qf->used), 1, out) != 1 ||
+			fwrite(qf->words, qf->bytes, 1, out) != 1;
+}
+
+static int quotient_load(struct filter *f, FILE *in) {
+	struct quotient_filter *qf = f->priv;
+	unsigned int qbits, fp_bits;
+
+	if (fread(&qbits, sizeof(qbits), 1, in) != 1 ||
+			fread(&fp_bits, sizeof(fp_bits), 1, in) != 1 ||
+			fp_bits != qf->fp_bits || qbits >= fp_bits) {
+		return 1;
+	}
+
+	// it may have grown since it was set up
+	mem_free(qf->words);
+	if (qf_alloc(qf, qbits, fp_bits)) {
+		return 1;
+	}
+
+	return fread(&qf->used, sizeof(qf->used), 1, in) != 1 ||
+			fread(qf->words, qf->bytes, 1, in) != 1;
+}
+
+static void quotient_free(struct filter *f) {
+	struct quotient_filter *qf = f->priv;
+
+	mem_free(qf->words);
+	free(qf);
+	f->priv = NULL;
+}
+
+const struct filter_ops filter_quotient = {
+	.name = "quotient",
+	.description = "quotient filter of key prefixes, grows and merges",
+	.init = quotient_init,
+	.check = quotient_check,
+	.add = quotient_add,
+	.prefetch = quotient_prefetch,
+	.bytes = quotient_bytes,
+	.fill = quotient_fill,
+	.save = quotient_save,
+	.load = quotient_load,
+	.merge = quotient_merge,
+	.free = quotient_free,
+};
@@ -1,177 +1,279 @@
+#include <getopt.h>
 #include <stdio.h>
-#include "sha256.h"
-#include "libbloom/bloom.h"
-#include "leveldb/include/leveldb/c.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chain.h"
+#include "mem.h"
+#include "phase.h"
+#include "search.h"
 
-#define BITLEN 42
-#define BLOOM_ELEMS 10000000UL
-#define BLOOM_PROB 0.0001
 
+static const struct mode {
+	const char *name;
+	int (*search)(const struct search_options *opts);
+	const char *description;
+} modes[] = {
+	{ "bloom", search_bloom, "membership filter, verified with a store (default)" },
+	{ "table", search_table, "exact in-memory hash table, no LevelDB" },
+	{ "brent", search_brent, "Brent's cycle finding, constant memory" },
+	{ "dp",    search_dp,    "parallel search storing distinguished points" },
+	{ "sort",  search_sort,  "radix sorted blocks of steps, no filter or store" },
+	{ "extsort", search_extsort, "sorted blocks in segment files, merged on disk" },
+	{ "pipe",  search_pipe,  "bloom mode with hashing threads feeding ring buffers" },
+};
 
-size_t trim_hash(unsigned char* hash) {
-	// trim the hash (in-place) to just the BITLEN prefix,
-	// ie. pad it with 0s to whole bytes and return the (truncated) byte length
-	size_t bits = BITLEN % 8;
-	size_t len = bits ? (BITLEN / 8) + 1 : (BITLEN / 8);
+#define NUM_MODES (sizeof(modes) / sizeof(modes[0]))
 
-	if (bits) {
-		hash[len-1] = hash[len-1] & (0xFF << (8 - bits));
-	}
-
-	return len;
-}
+static const struct option long_options[] = {
+	{ "bits",       required_argument, NULL, 'b' },
+	{ "elems",      required_argument, NULL, 'n' },
+	{ "fpr",        required_argument, NULL, 'p' },
+	{ "index",      required_argument, NULL, 'x' },
+	{ "filter-file", required_argument, NULL, 'F' },
+	{ "queue",      required_argument, NULL, 'q' },
+	{ "pages",      required_argument, NULL, 'H' },
+	{ "numa",       required_argument, NULL, 'N' },
+	{ "resume",     no_argument,       NULL, 'r' },
+	{ "checkpoint", required_argument, NULL, 'i' },
+	{ "stats",      required_argument, NULL, 'S' },
+	{ "metrics",    required_argument, NULL, 'M' },
+	{ "help",       no_argument,       NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
 
-int main(void) {
-	printf("SHACollider searching for %d-bit collision...\n", BITLEN);
-
-	// 256 bits of "random" stuff
-	unsigned char prev[SHA256_HASH_SIZE] = {
-		0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
-		0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
-		0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA
-	};
-	unsigned char hash[SHA256_HASH_SIZE];
 
-	// initialize LevelDB
-	leveldb_t *db;
-	leveldb_options_t *options = leveldb_options_create();
-	leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-	leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-	char *err = NULL;
-	char *read;
-	size_t read_len;
-
-	leveldb_options_set_create_if_missing(options, 1);
-	db = leveldb_open(options, "shadb", &err);
-
-	if (err != NULL) {
-		printf("Failed to create/open the LevelDB database.\n");
-		return 1;
+void usage(const char *name) {
+	printf("Usage: %s [-b bits] [-m mode] [-c chains] [-k kernel] [-t threads]\n"
+			"       [-d bits] [-n elems] [-p fpr] [-f filter] [-s store] [-x steps]\n"
+			"       [-F file] [-q slots] [-H pages] [-N numa] [-i secs] [-r]\n"
+			"       [-S secs] [-M file]\n", name);
+	printf("  -b, --bits bits\n");
+	printf("             length of the colliding prefix (%d-%d, default %d)\n",
+			BITLEN_MIN, BITLEN_MAX, BITLEN_DEFAULT);
+	printf("  -m mode    search mode:\n");
+	for (size_t i = 0; i < NUM_MODES; i++) {
+		printf("               %-8s %s\n", modes[i].name, modes[i].description);
 	}
-
-	leveldb_free(err);
-	err = NULL;
-
-	// bloom filter for efficient in-memory collision detection
-	struct bloom bloom;
-	printf("Setting up bloom filter for up to %luM elems @ %f FP probability.\n",
-			BLOOM_ELEMS / 1000000, BLOOM_PROB);
-	if (bloom_init(&bloom, BLOOM_ELEMS, BLOOM_PROB)) {
-		printf("Failed to init bloom filter! Tried to allocate %.2f MB.\n",
-				(double) bloom.bytes / 1024 / 1024);
-		bloom_print(&bloom);
-		return 1;
+	printf("  -c chains  number of chains to walk interleaved (1-%d, default 1)\n",
+			MAX_CHAINS);
+	printf("  -k kernel  SHA-256 kernel: avx512, avx2, shani or scalar\n");
+	printf("             (default: fastest supported)\n");
+	printf("  -t threads worker threads in dp mode, hashing threads in pipe mode\n");
+	printf("             (default: all cores)\n");
+	printf("  -d bits    leading zero bits of distinguished points in dp mode\n");
+	printf("             (default: a quarter of the prefix length)\n");
+	printf("  -n, --elems elems\n");
+	printf("             elements to size the filter, store, hash table and sorted\n");
+	printf("             runs for\n");
+	printf("             (default %lu)\n", DEFAULT_ELEMS);
+	printf("  -p, --fpr fpr\n");
+	printf("             false positive rate of the filter in bloom mode\n");
+	printf("             (default %g)\n", DEFAULT_FPR);
+	printf("  -f filter  membership filter in bloom and pipe mode:\n");
+	for (size_t i = 0; filter_backends[i] != NULL; i++) {
+		printf("               %-8s %s\n", filter_backends[i]->name,
+				filter_backends[i]->description);
 	}
-	printf("Bloom filter using %.2f MB (%.2f bits per element).\n",
-			(double) bloom.bytes / 1024 / 1024, bloom.bpe);
-
-	unsigned long long steps = 1;
-	unsigned long long dbqueries = 0;
-	for(;;) {
-		// calculate hash of the first BITLEN bits of data
-		SHA256_Context ctx;
-		sha256_initialize(&ctx);
-		sha256_add_bits(&ctx, &prev, BITLEN);
-		sha256_calculate(&ctx, hash);
-		
-		// trim the hash
-		size_t len = trim_hash(hash);
+	printf("  -s store   where bloom and pipe mode verify candidates:\n");
+	for (size_t i = 0; store_backends[i] != NULL; i++) {
+		printf("               %-8s %s\n", store_backends[i]->name,
+				store_backends[i]->description);
+	}
+	printf("  -x, --index steps\n");
+	printf("             store step numbers instead of preimages in bloom mode,\n");
+	printf("             replaying the chains from snapshots taken every so many\n");
+	printf("             steps to find a collision's preimages\n");
+	printf("  -F, --filter-file file\n");
+	printf("             keep the filter (bloom and pipe mode, not the growing ones)\n");
+	printf("             or hash table (table mode) in a memory mapped file, and\n");
+	printf("             pick it up from there when run again\n");
+	printf("  -q, --queue slots\n");
+	printf("             ring buffer slots per hashing thread in pipe mode, a power\n");
+	printf("             of two (default %lu)\n", DEFAULT_QUEUE);
+	printf("  -H, --pages pages\n");
+	printf("             page size for the filters and hash tables: 1G, 2M (both\n");
+	printf("             need pages reserved in /proc/sys/vm/nr_hugepages or\n");
+	printf("             /sys/kernel/mm/hugepages), thp for transparent huge pages,\n");
+	printf("             none, or auto for the largest there are (default)\n");
+	printf("  -N, --numa placement\n");
+	printf("             where their memory goes on NUMA machines: interleave over\n");
+	printf("             all nodes, local to the starting node, or none (default);\n");
+	printf("             the threads are pinned to match\n");
+	printf("  -i, --checkpoint secs\n");
+	printf("             seconds between checkpoints in bloom mode, 0 for none\n");
+	printf("             (default 300)\n");
+	printf("  -r, --resume\n");
+	printf("             continue from the last checkpoint\n");
+	printf("  -S, --stats secs\n");
+	printf("             seconds between progress reports on stderr in bloom mode,\n");
+	printf("             0 for none (default 10)\n");
+	printf("  -M, --metrics file\n");
+	printf("             also write the reports to a Prometheus text file\n");
+}
 
-#ifdef DEBUG
-		// debug print
-		for (size_t i=0; i<len; i++) {
-			printf("%02X", hash[i]);
-		}
-		printf("\n");
-#endif //DEBUG
+int main(int argc, char **argv) {
+	struct search_options opts = {
+		.chains = 1,
+		.threads = sysconf(_SC_NPROCESSORS_ONLN),
+		.filter = filter_backends[0],
+		.store = store_backends[0],
+		.queue = DEFAULT_QUEUE,
+		.elems = DEFAULT_ELEMS,
+		.fpr = DEFAULT_FPR,
+		.checkpoint_secs = 300,
+		.stats_secs = 10,
+	};
+	const struct mode *mode = &modes[0];
+	const char *kernel = NULL;
+	const char *pages = "auto", *numa = "none";
+	unsigned int bits = BITLEN_DEFAULT;
+	int opt;
 
-		// check if bloom filter already (probably) contains the hash
-		if (bloom_check(&bloom, hash, len)) {
-#ifdef DEBUG
-			printf("Found possible collision after %llu iterations :: ", steps);
-			for (size_t i=0; i<len; i++) {
-				printf("%02X", hash[i]);
+	while ((opt = getopt_long(argc, argv, "b:m:c:k:t:d:n:p:f:s:x:F:q:H:N:i:rS:M:h", long_options,
+			NULL)) != -1) {
+		switch (opt) {
+		case 'b':
+			bits = atoi(optarg);
+			break;
+		case 'm':
+			mode = NULL;
+			for (size_t i = 0; i < NUM_MODES; i++) {
+				if (strcmp(optarg, modes[i].name) == 0) {
+					mode = &modes[i];
+				}
 			}
-			printf("\n");
-#endif
-
-			// need to make sure it wasn't a false positive
-			// by searching for the hash in LevelDB
-			// if it's not found then continue, else break
-			read = leveldb_get(db, roptions, (char*) hash, len, &read_len, &err);
-
-			if (err != NULL) {
-				printf("LevelDB read fail!\n");
+			if (mode == NULL) {
+				printf("Unknown search mode '%s'.\n", optarg);
+				usage(argv[0]);
 				return 1;
 			}
-
-			leveldb_free(err);
-			err = NULL;
-
-			if (read == NULL) {
-				// not found
-#ifdef DEBUG
-				printf("Candidate collision hash was a false positive.\n");
-#endif
-				dbqueries++;
-			} else {
-#ifdef DEBUG
-				printf("LevelDB confirmed the collision! \\o/\n");
-#endif
-				double fpr = (double) dbqueries / steps;
-				printf("Found %d-bit collision after %llu iterations :: ",
-						BITLEN, steps);
-				for (size_t i=0; i<len; i++) {
-					printf("%02X", hash[i]);
-				}
-				printf("\n");
-				printf("Data with the same hash:\n");
-				printf("\t");
-				for (size_t i=0; i<read_len; i++) {
-					printf("%02X", (unsigned char) read[i]);
-				}
-				printf("\n\t");
-				for (size_t i=0; i<len; i++) {
-					printf("%02X", prev[i]);
-				}
-				printf("\n");
-				printf("Extra Queries to LevelDB: %llu (%f real FPR).\n",
-						dbqueries, fpr);
-				break;
+			break;
+		case 'c':
+			opts.chains = atoi(optarg);
+			if (opts.chains < 1 || opts.chains > MAX_CHAINS) {
+				printf("Number of chains must be between 1 and %d.\n",
+						MAX_CHAINS);
+				return 1;
 			}
-		}
-
-		// add the trimmed hash to the bloom filter
-		bloom_add(&bloom, hash, len);
-		// ...and to the database
-		leveldb_put(db, woptions, (char*) hash, len, (char*) prev, len, &err);
-		// current -> prev
-		memcpy(&prev, &hash, len);
-
-		if (steps >= BLOOM_ELEMS) {
-			// continuing would drastically increase false-positive rate
-			printf("Bloom filter capacity exceeded, exiting.\n");
 			break;
-		} else {
-			// rinse and repeat
-			steps++;
+		case 'k':
+			kernel = optarg;
+			break;
+		case 't':
+			opts.threads = atoi(optarg);
+			if (opts.threads < 1) {
+				printf("Need at least one thread.\n");
+				return 1;
+			}
+			break;
+		case 'd':
+			opts.dp_bits = atoi(optarg);
+			break;
+		case 'n':
+			opts.elems = strtoul(optarg, NULL, 10);
+			if (opts.elems < 1) {
+				printf("Need room for at least one element.\n");
+				return 1;
+			}
+			break;
+		case 'p':
+			opts.fpr = atof(optarg);
+			if (opts.fpr <= 0 || opts.fpr >= 1) {
+				printf("False positive rate must be between 0 and 1.\n");
+				return 1;
+			}
+			break;
+		case 'f':
+			opts.filter = filter_find(optarg);
+			if (opts.filter == NULL) {
+				printf("Unknown filter '%s'.\n", optarg);
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			opts.store = store_find(optarg);
+			if (opts.store == NULL) {
+				printf("Unknown store '%s'.\n", optarg);
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'x':
+			opts.index = strtoul(optarg, NULL, 10);
+			if (opts.index < 1) {
+				printf("Need at least one step between snapshots.\n");
+				return 1;
+			}
+			break;
+		case 'F':
+			opts.filter_file = optarg;
+			break;
+		case 'q':
+			opts.queue = strtoul(optarg, NULL, 10);
+			break;
+		case 'H':
+			pages = optarg;
+			break;
+		case 'N':
+			numa = optarg;
+			break;
+		case 'i':
+			opts.checkpoint_secs = atoi(optarg);
+			break;
+		case 'r':
+			opts.resume = 1;
+			break;
+		case 'S':
+			opts.stats_secs = atoi(optarg);
+			break;
+		case 'M':
+			opts.metrics_path = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
 		}
 	}
 
-	bloom_free(&bloom);
+	// sets bitlen (a CHAIN_BITS build only takes its own)
+	if (chain_init(bits)) {
+		printf("Prefix length must be between %d and %d bits.\n",
+				BITLEN_MIN, BITLEN_MAX);
+		return 1;
+	}
+	printf("SHACollider searching for %u-bit collision...\n", bitlen);
 
-	leveldb_close(db);
-	leveldb_destroy_db(options, "shadb", &err);
+	// pick the fastest SHA-256 implementation the CPU supports
+	// unless asked for a specific one
+	if (sha256_select_kernel(kernel) != SHA_DIGEST_OK) {
+		printf("SHA-256 kernel '%s' is not supported on this machine.\n",
+				kernel);
+		return 1;
+	}
+	printf("Using %s SHA-256 kernel, walking %u chain(s) in %s mode.\n",
+			sha256_kernel_name(), opts.chains, mode->name);
 
-	if (err != NULL) {
-		printf("%s\n", err);
-		printf("Failed to destroy LevelDB!\n");
+	if (mem_setup(pages, numa)) {
+		printf("Unknown page size '%s' or NUMA placement '%s'.\n", pages, numa);
 		return 1;
 	}
+	// the main thread probes the filter in most modes, so it gets the
+	// first CPU of the placement
+	mem_pin_thread();
 
-	leveldb_free(err);
-	err = NULL;
+#ifdef PHASE_TIMERS
+	phase_init();
+#endif
+	int ret = mode->search(&opts);
+#ifdef PHASE_TIMERS
+	phase_report();
+#endif
+	mem_report();
 
-	return 0;
+	return ret;
 }
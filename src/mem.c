@@ -0,0 +1,587 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "mem.h"
+
+#define MEM_MAX_REGIONS 64
+#define MEM_MAX_NODES 1024
+#define MEM_ALIGN 64
+#define PAGE_SMALL 4096UL
+#define PAGE_2M (1UL << 21)
+#define PAGE_1G (1UL << 30)
+#define NODE_DIR "/sys/devices/system/node"
+#define FILE_MAGIC "SHACMEM"
+#define FILE_VERSION 1
+// the header takes a page of its own, so the data is page aligned
+#define FILE_HEADER 4096
+
+enum pages { PAGES_AUTO, PAGES_1G, PAGES_2M, PAGES_THP, PAGES_NONE, NUM_PAGES };
+enum numa { NUMA_NONE, NUMA_INTERLEAVE, NUMA_LOCAL, NUM_NUMA };
+
+static const char *const page_names[NUM_PAGES] = {
+	[PAGES_AUTO] = "auto",
+	[PAGES_1G] = "1G",
+	[PAGES_2M] = "2M",
+	[PAGES_THP] = "thp",
+	[PAGES_NONE] = "none",
+};
+
+static const char *const numa_names[NUM_NUMA] = {
+	[NUMA_NONE] = "none",
+	[NUMA_INTERLEAVE] = "interleave",
+	[NUMA_LOCAL] = "local",
+};
+
+struct region {
+	void *p;
+	size_t len;
+	// hugetlb page size, 0 for small (maybe transparent huge) pages
+	size_t page;
+	// given to mem_advise(), not ours to unmap
+	int advised;
+	// mapped from a file by mem_map_file(), locked through fd
+	struct file_header *file;
+	int fd;
+};
+
+// in front of the data of a mem_map_file() file; written as is, so a
+// file can only be attached to by the same build on the same machine
+struct file_header {
+	char magic[8];
+	uint32_t version;
+	// set while nobody has the file mapped
+	uint32_t clean;
+	char kind[16];
+	uint64_t bytes;
+	uint64_t params_len;
+	unsigned char params[MEM_FILE_PARAMS];
+	unsigned char state[MEM_FILE_STATE];
+};
+
+static enum pages pages = PAGES_AUTO;
+static enum numa numa = NUMA_NONE;
+
+// where the memory goes and the order threads are pinned in
+static unsigned long nodemask[MEM_MAX_NODES / 64];
+static unsigned int num_nodes;
+static int cpus[CPU_SETSIZE];
+static unsigned int num_cpus;
+static atomic_uint next_cpu;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct region regions[MEM_MAX_REGIONS];
+
+// bytes ever allocated on hugetlb pages and otherwise mapped or advised,
+// and how much of the latter turned out to be transparent huge pages
+// (measured when they're freed)
+static size_t huge_1g, huge_2m, mapped, mapped_thp, filed;
+static int numa_failed;
+
+
+static int read_list(const char *path, unsigned char *set, size_t max) {
+	// a kernel list like "0-3,8,10-11"
+	FILE *f = fopen(path, "r");
+	unsigned long a, b;
+	int c = ',';
+
+	if (f == NULL) {
+		return 1;
+	}
+	memset(set, 0, max);
+	while (c == ',' && fscanf(f, "%lu", &a) == 1) {
+		b = a;
+		if ((c = fgetc(f)) == '-') {
+			if (fscanf(f, "%lu", &b) != 1) {
+				break;
+			}
+			c = fgetc(f);
+		}
+		for (; a <= b && a < max; a++) {
+			set[a] = 1;
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static void setup_nodes(void) {
+	static unsigned char nodes[MEM_MAX_NODES], node_cpus[CPU_SETSIZE];
+	static int node_of[CPU_SETSIZE], rank[CPU_SETSIZE];
+	unsigned int per_node[MEM_MAX_NODES] = { 0 };
+	unsigned int max_rank = 0;
+	cpu_set_t allowed;
+	int local = -1;
+
+	if (read_list(NODE_DIR "/online", nodes, MEM_MAX_NODES) ||
+			sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		return;
+	}
+
+	// which node every CPU we may run on is on, and the how-manieth of
+	// that node's CPUs it is
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		node_of[cpu] = -1;
+	}
+	for (unsigned int n = 0; n < MEM_MAX_NODES; n++) {
+		char path[64];
+
+		snprintf(path, sizeof(path), NODE_DIR "/node%u/cpulist", n);
+		if (!nodes[n] || read_list(path, node_cpus, CPU_SETSIZE)) {
+			continue;
+		}
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (node_cpus[cpu] && CPU_ISSET(cpu, &allowed)) {
+				node_of[cpu] = n;
+				rank[cpu] = per_node[n]++;
+				max_rank = rank[cpu] + 1 > max_rank ? rank[cpu] + 1 : max_rank;
+			}
+		}
+	}
+
+	int here = sched_getcpu();
+	if (here >= 0 && here < CPU_SETSIZE && node_of[here] >= 0) {
+		local = node_of[here];
+	}
+	for (int cpu = 0; local < 0 && cpu < CPU_SETSIZE; cpu++) {
+		local = node_of[cpu];
+	}
+	if (local < 0) {
+		return;
+	}
+
+	// interleaving takes the first CPU of every node, then the second
+	// of every node and so on; local only the local node's
+	for (unsigned int n = 0; n < MEM_MAX_NODES; n++) {
+		if (per_node[n] > 0 && (numa == NUMA_INTERLEAVE || (int) n == local)) {
+			nodemask[n / 64] |= 1UL << (n % 64);
+			num_nodes++;
+		}
+	}
+	for (unsigned int r = 0; r < max_rank; r++) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (node_of[cpu] >= 0 && rank[cpu] == (int) r &&
+					(nodemask[node_of[cpu] / 64] >> (node_of[cpu] % 64) & 1)) {
+				cpus[num_cpus++] = cpu;
+			}
+		}
+	}
+}
+
+int mem_setup(const char *page_name, const char *numa_name) {
+	int p, n;
+
+	for (p = 0; p < NUM_PAGES && strcmp(page_name, page_names[p]); p++);
+	for (n = 0; n < NUM_NUMA && strcmp(numa_name, numa_names[n]); n++);
+	if (p == NUM_PAGES || n == NUM_NUMA) {
+		return 1;
+	}
+	pages = p;
+	numa = n;
+
+	if (numa != NUMA_NONE) {
+		setup_nodes();
+	}
+
+	return 0;
+}
+
+static void place(void *p, size_t len) {
+	// before the pages are touched, so they're allocated where asked
+	int mode = numa == NUMA_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_PREFERRED;
+
+	if (num_nodes == 0 || len == 0) {
+		return;
+	}
+	if (syscall(SYS_mbind, p, len, mode, nodemask, MEM_MAX_NODES + 1, 0)) {
+		numa_failed = 1;
+	}
+}
+
+static void *map(size_t len, size_t page) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *p;
+
+	if (page == PAGE_2M) {
+		flags |= MAP_HUGETLB | 21 << MAP_HUGE_SHIFT;
+	} else if (page == PAGE_1G) {
+		flags |= MAP_HUGETLB | 30 << MAP_HUGE_SHIFT;
+	}
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void *map_small(size_t len) {
+	// aligned to 2 MB so transparent huge pages can back all of it
+	size_t slack = pages == PAGES_NONE ? 0 : PAGE_2M;
+	char *raw = map(len + slack, 0);
+	char *p;
+
+	if (raw == NULL) {
+		return NULL;
+	}
+	p = slack ? (char *) (((uintptr_t) raw + slack - 1) & ~(uintptr_t) (slack - 1)) : raw;
+	if (p > raw) {
+		munmap(raw, p - raw);
+	}
+	if (raw + slack > p) {
+		munmap(p + len, raw + slack - p);
+	}
+
+	madvise(p, len, pages == PAGES_NONE ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+	return p;
+}
+
+static size_t thp_bytes(const void *p, size_t len) {
+	// what of the range the kernel backs with transparent huge pages,
+	// from the AnonHugePages of the mappings it overlaps
+	FILE *f = fopen("/proc/self/smaps", "r");
+	uintptr_t from = (uintptr_t) p, to = from + len;
+	char line[256];
+	size_t kb, sum = 0;
+	int in = 0;
+
+	if (f == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned long start, end;
+
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			in = start < to && end > from;
+		} else if (in && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+			sum += kb * 1024;
+		}
+	}
+	fclose(f);
+
+	return sum < len ? sum : len;
+}
+
+static struct region *region_find(const void *p) {
+	for (size_t i = 0; i < MEM_MAX_REGIONS; i++) {
+		if (regions[i].p == p) {
+			return &regions[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void *small_alloc(size_t bytes) {
+	size_t len = bytes ? (bytes + MEM_ALIGN - 1) & ~(size_t) (MEM_ALIGN - 1) : MEM_ALIGN;
+	void *p = aligned_alloc(MEM_ALIGN, len);
+
+	if (p != NULL) {
+		memset(p, 0, len);
+	}
+	return p;
+}
+
+void *mem_alloc(size_t bytes) {
+	struct region r = { 0 };
+
+	if (bytes < MEM_MIN_BYTES) {
+		return small_alloc(bytes);
+	}
+
+	pthread_mutex_lock(&lock);
+	struct region *slot = region_find(NULL);
+	if (slot == NULL) {
+		pthread_mutex_unlock(&lock);
+		return small_alloc(bytes);
+	}
+
+	// hugetlb pages if there are any reserved (1 GB ones unasked only
+	// if rounding up to them wastes little), else small pages that may
+	// get merged into transparent huge pages
+	r.len = (bytes + PAGE_1G - 1) & ~(PAGE_1G - 1);
+	if (pages == PAGES_1G || (pages == PAGES_AUTO && (r.len - bytes) * 8 <= bytes)) {
+		r.page = PAGE_1G;
+		r.p = map(r.len, r.page);
+	}
+	if (r.p == NULL && (pages == PAGES_1G || pages == PAGES_2M || pages == PAGES_AUTO)) {
+		r.len = (bytes + PAGE_2M - 1) & ~(PAGE_2M - 1);
+		r.page = PAGE_2M;
+		r.p = map(r.len, r.page);
+	}
+	if (r.p == NULL) {
+		r.len = (bytes + PAGE_SMALL - 1) & ~(PAGE_SMALL - 1);
+		r.page = 0;
+		r.p = map_small(r.len);
+	}
+
+	if (r.p != NULL) {
+		place(r.p, r.len);
+		*slot = r;
+		if (r.page == PAGE_1G) {
+			huge_1g += r.len;
+		} else if (r.page == PAGE_2M) {
+			huge_2m += r.len;
+		} else {
+			mapped += r.len;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	// fresh mappings are zeroed already
+	return r.p;
+}
+
+void mem_free(void *p) {
+	struct region *r;
+
+	if (p == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	r = region_find(p);
+	if (r == NULL || r->advised) {
+		pthread_mutex_unlock(&lock);
+		free(p);
+		return;
+	}
+	if (r->file != NULL) {
+		// the kernel writes it back whenever it likes, that's the point
+		r->file->clean = 1;
+		munmap(r->file, FILE_HEADER + r->len);
+		close(r->fd);
+		memset(r, 0, sizeof(*r));
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	if (r->page == 0) {
+		mapped_thp += thp_bytes(r->p, r->len);
+	}
+	munmap(r->p, r->len);
+	memset(r, 0, sizeof(*r));
+	pthread_mutex_unlock(&lock);
+}
+
+void mem_advise(void *p, size_t bytes) {
+	// only whole pages, and only the ones that aren't touched yet get
+	// the policy, which for a fresh calloc() of this size is all of them
+	uintptr_t from = ((uintptr_t) p + PAGE_SMALL - 1) & ~(PAGE_SMALL - 1);
+	uintptr_t to = ((uintptr_t) p + bytes) & ~(PAGE_SMALL - 1);
+
+	if (bytes < MEM_MIN_BYTES || to <= from) {
+		return;
+	}
+	madvise((void *) from, to - from,
+			pages == PAGES_NONE ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+	place((void *) from, to - from);
+
+	pthread_mutex_lock(&lock);
+	struct region *slot = region_find(NULL);
+	if (slot != NULL) {
+		*slot = (struct region) {
+			.p = p,
+			.len = bytes,
+			.advised = 1,
+		};
+		mapped += bytes;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void mem_forget(void *p) {
+	struct region *r;
+
+	pthread_mutex_lock(&lock);
+	r = p != NULL ? region_find(p) : NULL;
+	if (r != NULL && r->advised) {
+		mapped_thp += thp_bytes(r->p, r->len);
+		memset(r, 0, sizeof(*r));
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void *mem_map_file(const char *path, const char *kind, const void *params,
+		size_t params_len, size_t bytes, int *attached) {
+	size_t len = FILE_HEADER + bytes;
+	struct file_header *h;
+	struct stat st;
+	int fd, fresh;
+
+	*attached = 0;
+	if (params_len > MEM_FILE_PARAMS || strlen(kind) >= sizeof(h->kind)) {
+		return NULL;
+	}
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &st)) {
+		printf("Failed to open %s.\n", path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	// one process at a time, the structures aren't shared
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		printf("%s is in use by another process.\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	// an empty file is a new one, anything else has to be the same
+	// structure set up the same way
+	fresh = st.st_size == 0;
+	if (fresh ? ftruncate(fd, len) != 0 : (size_t) st.st_size != len) {
+		printf(fresh ? "Failed to create %s.\n" :
+				"%s holds something else, remove it to start over.\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		printf("Failed to map %.2f MB of %s.\n", (double) len / 1024 / 1024,
+				path);
+		if (fresh) {
+			unlink(path);
+		}
+		close(fd);
+		return NULL;
+	}
+
+	if (fresh) {
+		memcpy(h->magic, FILE_MAGIC, sizeof(h->magic));
+		h->version = FILE_VERSION;
+		strcpy(h->kind, kind);
+		h->bytes = bytes;
+		h->params_len = params_len;
+		memcpy(h->params, params, params_len);
+	} else if (memcmp(h->magic, FILE_MAGIC, sizeof(h->magic)) != 0 ||
+			h->version != FILE_VERSION || strcmp(h->kind, kind) != 0 ||
+			h->bytes != bytes || h->params_len != params_len ||
+			memcmp(h->params, params, params_len) != 0) {
+		printf("%s holds something else, remove it to start over.\n", path);
+		munmap(h, len);
+		close(fd);
+		return NULL;
+	} else if (!h->clean) {
+		printf("%s wasn't closed cleanly, its counters may be behind.\n",
+				path);
+	}
+	h->clean = 0;
+
+	pthread_mutex_lock(&lock);
+	struct region *slot = region_find(NULL);
+	if (slot == NULL) {
+		pthread_mutex_unlock(&lock);
+		munmap(h, len);
+		close(fd);
+		return NULL;
+	}
+	*slot = (struct region) {
+		.p = (char *) h + FILE_HEADER,
+		.len = bytes,
+		.file = h,
+		.fd = fd,
+	};
+	filed += bytes;
+	pthread_mutex_unlock(&lock);
+
+	*attached = !fresh;
+	return (char *) h + FILE_HEADER;
+}
+
+void *mem_file_state(void *p) {
+	struct region *r;
+
+	pthread_mutex_lock(&lock);
+	r = p != NULL ? region_find(p) : NULL;
+	pthread_mutex_unlock(&lock);
+
+	return r != NULL && r->file != NULL ? r->file->state : NULL;
+}
+
+int mem_file_clear(void *p) {
+	struct region *r;
+
+	pthread_mutex_lock(&lock);
+	r = p != NULL ? region_find(p) : NULL;
+	pthread_mutex_unlock(&lock);
+
+	if (r == NULL || r->file == NULL) {
+		return 1;
+	}
+	// truncating the data away and back drops its pages instead of
+	// writing zeros over all of them
+	if (ftruncate(r->fd, FILE_HEADER) != 0 ||
+			ftruncate(r->fd, FILE_HEADER + r->len) != 0) {
+		return 1;
+	}
+	memset(r->file->state, 0, sizeof(r->file->state));
+
+	return 0;
+}
+
+int mem_sync(void *p) {
+	struct region *r;
+
+	pthread_mutex_lock(&lock);
+	r = p != NULL ? region_find(p) : NULL;
+	pthread_mutex_unlock(&lock);
+
+	if (r == NULL || r->file == NULL) {
+		return 0;
+	}
+	return msync(r->file, FILE_HEADER + r->len, MS_SYNC) != 0;
+}
+
+void mem_pin_thread(void) {
+	cpu_set_t set;
+
+	if (num_cpus == 0) {
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpus[atomic_fetch_add(&next_cpu, 1) % num_cpus], &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+void mem_report(void) {
+	size_t thp = mapped_thp;
+
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < MEM_MAX_REGIONS; i++) {
+		if (regions[i].p != NULL && regions[i].page == 0 &&
+				regions[i].file == NULL) {
+			thp += thp_bytes(regions[i].p, regions[i].len);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (huge_1g + huge_2m + mapped + filed == 0) {
+		return;
+	}
+	printf("Large allocations: %.1f MB on 1 GB pages, %.1f MB on 2 MB pages, "
+			"%.1f of %.1f MB on transparent huge pages", huge_1g / 1048576.0,
+			huge_2m / 1048576.0, thp / 1048576.0, mapped / 1048576.0);
+	if (filed > 0) {
+		printf(", %.1f MB mapped from files", filed / 1048576.0);
+	}
+	if (num_nodes > 0 && numa == NUMA_INTERLEAVE) {
+		printf(", interleaved over %u NUMA node(s)", num_nodes);
+	} else if (num_nodes > 0) {
+		printf(", on the local NUMA node");
+	}
+	if (numa_failed) {
+		printf(" (NUMA placement failed)");
+	}
+	printf(".\n");
+}
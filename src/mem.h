@@ -0,0 +1,65 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+
+// Allocations for the big in-memory structures (filters, hash tables):
+// backed by huge pages where the system has them, so a multi-GB filter
+// doesn't miss the TLB on every probe, and spread over or kept on NUMA
+// nodes as asked, with the threads pinned to match. Small allocations
+// just go to malloc. What was actually obtained is printed by
+// mem_report(), the kernel may fall back to smaller pages silently.
+//
+// A structure can also live in a file instead (mem_map_file()), so that
+// a later run attaches to it as it was left rather than rebuilding it;
+// the page cache takes care of writing it back.
+
+// allocations smaller than this aren't worth a mapping of their own
+#define MEM_MIN_BYTES (1UL << 21)
+// room in a file's header for the layout of what's in it, and for its
+// owner's counters and such
+#define MEM_FILE_PARAMS 64
+#define MEM_FILE_STATE 1024
+
+// picks the page sizes ("auto", "1G", "2M", "thp" or "none") and NUMA
+// placement ("none", "interleave" or "local") for everything allocated
+// from then on; returns 0 on success and 1 for unknown names
+int mem_setup(const char *pages, const char *numa);
+
+// zeroed memory, aligned to at least a cache line, or NULL
+void *mem_alloc(size_t bytes);
+// frees memory from mem_alloc(), NULL is fine
+void mem_free(void *p);
+// applies the page size and NUMA policy to the untouched pages of
+// memory allocated elsewhere (eg. by a library), as far as it can
+void mem_advise(void *p, size_t bytes);
+// to be called before memory given to mem_advise() is freed
+void mem_forget(void *p);
+
+// like mem_alloc(), but a shared mapping of the file at path behind a
+// versioned header naming the kind of structure and its layout (params):
+// an existing file is attached to as it is (setting *attached) if the
+// header matches and refused if not, a missing or empty one is created
+// zeroed. The file stays locked against other processes until
+// mem_free(). Returns NULL on failure, mostly with the reason printed.
+void *mem_map_file(const char *path, const char *kind, const void *params,
+		size_t params_len, size_t bytes, int *attached);
+// the MEM_FILE_STATE bytes of a mem_map_file() header its owner may keep
+// its counters in (zeroed in a new file), NULL for other memory
+void *mem_file_state(void *p);
+// zeroes a mem_map_file() mapping and its state, for reusing a file from
+// another run afresh; returns 0 on success
+int mem_file_clear(void *p);
+// writes a mem_map_file() mapping back to its file and waits for it,
+// returns 0 on success; nothing to do for other memory
+int mem_sync(void *p);
+
+// pins the calling thread to the next CPU in an order that matches the
+// NUMA placement: round-robin over the nodes when interleaving, the
+// local node's CPUs otherwise; nothing without a NUMA placement
+void mem_pin_thread(void);
+
+// prints how much memory ended up on which page size and where
+void mem_report(void);
+
+#endif //MEM_H
@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "leveldb/cache.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/write_batch.h"
+#include "helpers/memenv/memenv.h"
+#include "memenv.h"
+
+struct memenv_db {
+	leveldb::Env *env;
+	leveldb::Cache *cache;
+	const leveldb::FilterPolicy *filter;
+	leveldb::DB *db;
+	leveldb::WriteBatch batch;
+};
+
+
+struct memenv_db *memenv_open(const char *name, size_t write_buffer,
+		size_t cache, int filter_bits) {
+	memenv_db *m = new memenv_db;
+	leveldb::Options options;
+
+	m->env = leveldb::NewMemEnv(leveldb::Env::Default());
+	m->cache = leveldb::NewLRUCache(cache);
+	m->filter = leveldb::NewBloomFilterPolicy(filter_bits);
+	m->db = NULL;
+
+	options.env = m->env;
+	options.create_if_missing = true;
+	options.compression = leveldb::kNoCompression;
+	options.write_buffer_size = write_buffer;
+	options.block_cache = m->cache;
+	options.filter_policy = m->filter;
+
+	leveldb::Status status = leveldb::DB::Open(options, name, &m->db);
+	if (!status.ok()) {
+		printf("Failed to create the in-memory LevelDB database: %s\n",
+				status.ToString().c_str());
+		memenv_close(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+int memenv_write(struct memenv_db *db, const unsigned char *recs, size_t n,
+		size_t key_len, size_t val_len) {
+	const char *rec = reinterpret_cast<const char *>(recs);
+
+	db->batch.Clear();
+	for (size_t i = 0; i < n; i++, rec += key_len + val_len) {
+		db->batch.Put(leveldb::Slice(rec, key_len),
+				leveldb::Slice(rec + key_len, val_len));
+	}
+
+	return !db->db->Write(leveldb::WriteOptions(), &db->batch).ok();
+}
+
+int memenv_get(struct memenv_db *db, const void *key, size_t key_len,
+		void *val, size_t val_len) {
+	std::string read;
+	leveldb::Status status = db->db->Get(leveldb::ReadOptions(),
+			leveldb::Slice(static_cast<const char *>(key), key_len), &read);
+
+	if (status.IsNotFound()) {
+		return 0;
+	}
+	if (!status.ok()) {
+		return -1;
+	}
+
+	memcpy(val, read.data(), read.size() < val_len ? read.size() : val_len);
+	return 1;
+}
+
+void memenv_close(struct memenv_db *db) {
+	// the database uses all the others
+	delete db->db;
+	delete db->filter;
+	delete db->cache;
+	delete db->env;
+	delete db;
+}
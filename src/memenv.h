@@ -0,0 +1,34 @@
+#ifndef MEMENV_H
+#define MEMENV_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// LevelDB's in-memory environment (helpers/memenv) isn't part of its C
+// API, so a database on it is opened and used through the C++ API here.
+
+struct memenv_db;
+
+// opens a new database in a fresh in-memory environment, tuned like the
+// one on disk; returns NULL (with the reason printed) on failure
+struct memenv_db *memenv_open(const char *name, size_t write_buffer,
+		size_t cache, int filter_bits);
+// commits n records of key_len + val_len bytes, back to back at recs, in
+// a single batch; returns 0 on success
+int memenv_write(struct memenv_db *db, const unsigned char *recs, size_t n,
+		size_t key_len, size_t val_len);
+// returns 1 and fills in up to val_len bytes of val if the key is there,
+// 0 if it isn't and -1 on errors
+int memenv_get(struct memenv_db *db, const void *key, size_t key_len,
+		void *val, size_t val_len);
+// closes the database and drops the environment with everything in it
+void memenv_close(struct memenv_db *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MEMENV_H
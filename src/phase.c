@@ -0,0 +1,180 @@
+#include "phase.h"
+
+#ifdef PHASE_TIMERS
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "stats.h"
+
+#define NUM_COUNTERS 3
+// widest histogram bar
+#define PHASE_BAR 40
+
+
+static const char *const phase_names[NUM_PHASES] = {
+	[PHASE_HASH] = "hash",
+	[PHASE_TRIM] = "trim+prefetch",
+	[PHASE_FILTER_CHECK] = "filter check",
+	[PHASE_STORE_GET] = "store get",
+	[PHASE_FILTER_ADD] = "filter add",
+	[PHASE_STORE_PUT] = "store put",
+};
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} counters[NUM_COUNTERS] = {
+	{ "cycles",       PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+	{ "LLC misses",   PERF_COUNT_HW_CACHE_MISSES },
+};
+
+// histograms in ticks rather than nanoseconds, same bucketing
+static struct latency phases[NUM_PHASES];
+static uint64_t totals[NUM_PHASES];
+
+// the counters' file descriptors, the first one leads the group
+static int counter_fds[NUM_COUNTERS] = { -1, -1, -1 };
+static uint64_t start_ticks;
+static double start_secs;
+
+
+#if !defined __x86_64__ && !defined __i386__
+uint64_t phase_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+void phase_record(enum phase p, uint64_t ticks) {
+	latency_add(&phases[p], ticks);
+	totals[p] += ticks;
+}
+
+static int counter_open(uint64_t config, int group) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	// user space only, which is what most perf_event_paranoid
+	// settings still allow
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+void phase_init(void) {
+	struct timespec ts;
+
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		counter_fds[i] = counter_open(counters[i].config, counter_fds[0]);
+		if (counter_fds[i] < 0) {
+			fprintf(stderr, "No %s counter (perf_event_open failed), "
+					"reporting ticks only.\n", counters[i].name);
+			break;
+		}
+	}
+	if (counter_fds[0] >= 0) {
+		ioctl(counter_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(counter_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start_secs = ts.tv_sec + ts.tv_nsec / 1e9;
+	start_ticks = phase_clock();
+}
+
+static void report_histogram(const struct latency *l) {
+	// one row per power of two, the finer buckets are for the percentiles
+	uint64_t rows[64] = { 0 };
+	uint64_t peak = 0;
+
+	for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+		unsigned int msb = b < 1 << LATENCY_SUB_BITS ?
+				(b ? 63 - __builtin_clzll(b) : 0) :
+				(b >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+
+		rows[msb] += l->buckets[b];
+	}
+	for (unsigned int r = 0; r < 64; r++) {
+		peak = rows[r] > peak ? rows[r] : peak;
+	}
+
+	for (unsigned int r = 0; r < 64; r++) {
+		if (rows[r] == 0) {
+			continue;
+		}
+		printf("    %10llu-%-10llu %11llu %5.1f%% %.*s\n",
+				r ? 1ULL << r : 0ULL, (2ULL << r) - 1,
+				(unsigned long long) rows[r], 100.0 * rows[r] / l->count,
+				(int) (PHASE_BAR * rows[r] / peak),
+				"########################################");
+	}
+}
+
+void phase_report(void) {
+	struct timespec ts;
+	uint64_t ticks = phase_clock() - start_ticks;
+	uint64_t timed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	double secs = ts.tv_sec + ts.tv_nsec / 1e9 - start_secs;
+
+	for (int p = 0; p < NUM_PHASES; p++) {
+		timed += totals[p];
+	}
+
+	printf("Phase timers: %.2f s, %.3f G ticks/s, %.1f%% of the ticks in "
+			"timed phases.\n", secs, ticks / secs / 1e9,
+			ticks ? 100.0 * timed / ticks : 0);
+	for (int p = 0; p < NUM_PHASES; p++) {
+		const struct latency *l = &phases[p];
+
+		if (l->count == 0) {
+			continue;
+		}
+		printf("  %-12s %11llu calls, mean %.1f, p50 %llu, p90 %llu, p99 %llu "
+				"ticks, %.1f%% of timed\n", phase_names[p],
+				(unsigned long long) l->count, (double) totals[p] / l->count,
+				(unsigned long long) latency_percentile(l, 0.5),
+				(unsigned long long) latency_percentile(l, 0.9),
+				(unsigned long long) latency_percentile(l, 0.99),
+				timed ? 100.0 * totals[p] / timed : 0);
+		report_histogram(l);
+	}
+
+	if (counter_fds[0] >= 0) {
+		// read with PERF_FORMAT_GROUP off, one counter at a time
+		uint64_t values[NUM_COUNTERS] = { 0 };
+
+		ioctl(counter_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		for (int i = 0; i < NUM_COUNTERS && counter_fds[i] >= 0; i++) {
+			if (read(counter_fds[i], &values[i], sizeof(values[i])) !=
+					sizeof(values[i])) {
+				values[i] = 0;
+			}
+			printf("  %-12s %llu\n", counters[i].name,
+					(unsigned long long) values[i]);
+			close(counter_fds[i]);
+			counter_fds[i] = -1;
+		}
+		if (values[0] && values[1]) {
+			printf("  IPC %.2f, %.2f LLC misses per 1000 instructions\n",
+					(double) values[1] / values[0],
+					1000.0 * values[2] / values[1]);
+		}
+	}
+}
+
+#endif //PHASE_TIMERS
@@ -0,0 +1,48 @@
+#ifndef PHASE_H
+#define PHASE_H
+
+#include <stdint.h>
+
+// Per-phase timers for the hot loop, only in the build made with
+// -DPHASE_TIMERS (make phases). Every phase gets a histogram of the
+// time stamp counter ticks it took each time, and the whole run the
+// CPU's cycle, instruction and last level cache miss counters where
+// perf_event_open allows it. All of it is printed by phase_report().
+// Not thread-safe, meant for the single-threaded bloom mode.
+
+enum phase {
+	PHASE_HASH,
+	PHASE_TRIM,
+	PHASE_FILTER_CHECK,
+	PHASE_STORE_GET,
+	PHASE_FILTER_ADD,
+	PHASE_STORE_PUT,
+	NUM_PHASES
+};
+
+#ifdef PHASE_TIMERS
+
+#if defined __x86_64__ || defined __i386__
+#include <x86intrin.h>
+// no serializing, the order of the neighbouring instructions is
+// only approximate but it costs a few dozen cycles instead of hundreds
+#define phase_clock() __rdtsc()
+#else
+uint64_t phase_clock(void);
+#endif
+
+void phase_record(enum phase p, uint64_t ticks);
+void phase_init(void);
+void phase_report(void);
+
+#define PHASE_BEGIN(p) uint64_t phase_start_##p = phase_clock()
+#define PHASE_END(p) phase_record(p, phase_clock() - phase_start_##p)
+
+#else
+
+#define PHASE_BEGIN(p)
+#define PHASE_END(p)
+
+#endif //PHASE_TIMERS
+
+#endif //PHASE_H
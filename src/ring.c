@@ -0,0 +1,101 @@
+#include <sched.h>
+#include <stdlib.h>
+#include "ring.h"
+#include "stats.h"
+
+
+int ring_init(struct ring *r, size_t slots, size_t rec_len) {
+	r->slots = slots;
+	r->rec_len = rec_len;
+	r->tail_cache = 0;
+	r->head_cache = 0;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->stalls, 0);
+	atomic_init(&r->stall_ns, 0);
+
+	r->buf = aligned_alloc(RING_CACHE_LINE,
+			(slots * rec_len + RING_CACHE_LINE - 1) & ~(size_t) (RING_CACHE_LINE - 1));
+	return r->buf == NULL;
+}
+
+void ring_free(struct ring *r) {
+	free(r->buf);
+	r->buf = NULL;
+}
+
+int ring_reserve(struct ring *r, size_t n, const atomic_int *stop) {
+	unsigned long long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	if (head + n - r->tail_cache <= r->slots) {
+		return 0;
+	}
+	r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if (head + n - r->tail_cache <= r->slots) {
+		return 0;
+	}
+
+	// full, the consumer has to catch up first
+	uint64_t start = stats_now_ns();
+	int ret = 0;
+
+	while (head + n - r->tail_cache > r->slots) {
+		if (atomic_load_explicit(stop, memory_order_relaxed)) {
+			ret = 1;
+			break;
+		}
+		sched_yield();
+		r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+	}
+	// only ever written here, the atomics are for the stats' sake
+	atomic_store_explicit(&r->stalls,
+			atomic_load_explicit(&r->stalls, memory_order_relaxed) + 1,
+			memory_order_relaxed);
+	atomic_store_explicit(&r->stall_ns,
+			atomic_load_explicit(&r->stall_ns, memory_order_relaxed) +
+					stats_now_ns() - start, memory_order_relaxed);
+
+	return ret;
+}
+
+void *ring_put_slot(struct ring *r, size_t i) {
+	unsigned long long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	return r->buf + ((head + i) & (r->slots - 1)) * r->rec_len;
+}
+
+void ring_publish(struct ring *r, size_t n) {
+	unsigned long long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+size_t ring_peek(struct ring *r, size_t max) {
+	unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	if (r->head_cache == tail) {
+		r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+	}
+
+	return r->head_cache - tail < max ? r->head_cache - tail : max;
+}
+
+const void *ring_get_slot(const struct ring *r, size_t i) {
+	unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	return r->buf + ((tail + i) & (r->slots - 1)) * r->rec_len;
+}
+
+void ring_release(struct ring *r, size_t n) {
+	unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+size_t ring_used(struct ring *r) {
+	unsigned long long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	unsigned long long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	// the tail is read first, so it's never past the head
+	return head - tail;
+}
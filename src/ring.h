@@ -0,0 +1,54 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Lock-free single-producer/single-consumer ring buffer of fixed-size
+// records. The producer fills slots past the head and publishes them in
+// one go, the consumer reads them past the tail and releases them when
+// done; each side caches the other's position so the shared cache lines
+// are only touched when the cached one runs out.
+
+#define RING_CACHE_LINE 64
+
+struct ring {
+	unsigned char *buf;
+	size_t slots;
+	size_t rec_len;
+
+	// producer side: records ever published, the tail as last seen, and
+	// how often and for how long it found the ring full (backpressure)
+	_Alignas(RING_CACHE_LINE) atomic_ullong head;
+	unsigned long long tail_cache;
+	atomic_ullong stalls;
+	atomic_ullong stall_ns;
+
+	// consumer side: records ever released, the head as last seen
+	_Alignas(RING_CACHE_LINE) atomic_ullong tail;
+	unsigned long long head_cache;
+};
+
+// slots has to be a power of two, returns 0 on success
+int ring_init(struct ring *r, size_t slots, size_t rec_len);
+void ring_free(struct ring *r);
+
+// producer: waits until there's room for n records, returns 1 if stop
+// got set in the meantime and 0 once there is
+int ring_reserve(struct ring *r, size_t n, const atomic_int *stop);
+// the i-th reserved slot
+void *ring_put_slot(struct ring *r, size_t i);
+// makes the first n reserved slots visible to the consumer
+void ring_publish(struct ring *r, size_t n);
+
+// consumer: number of records ready to read, at most max
+size_t ring_peek(struct ring *r, size_t max);
+// the i-th ready record
+const void *ring_get_slot(const struct ring *r, size_t i);
+// hands the first n ready slots back to the producer
+void ring_release(struct ring *r, size_t n);
+
+// records in the ring right now, from either side or a third thread
+size_t ring_used(struct ring *r);
+
+#endif //RING_H
@@ -0,0 +1,66 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "filter.h"
+#include "store.h"
+
+// independent chains walked in lock-step (one SIMD lane each)
+#define MAX_CHAINS 16
+// default number of elements the filter, store and table are sized for
+#define DEFAULT_ELEMS 10000000UL
+// ...and false positive rate of the membership filter
+#define DEFAULT_FPR 0.0001
+// slots of each hashing thread's ring buffer in pipe mode
+#define DEFAULT_QUEUE (1UL << 16)
+
+struct search_options {
+	unsigned int chains;
+	// worker threads (dp mode) or hashing threads (pipe mode)
+	unsigned int threads;
+	// ring buffer slots per hashing thread, a power of two (pipe mode)
+	unsigned long queue;
+	// leading zero bits that make a point distinguished, 0 for auto
+	unsigned int dp_bits;
+	// membership filter, and where its hits are verified (bloom and
+	// pipe mode)
+	const struct filter_ops *filter;
+	const struct store_ops *store;
+	// file the filter (bloom and pipe mode) or hash table (table mode) is
+	// kept in and picked up from by the next run, NULL for memory only
+	const char *filter_file;
+	// elements to size for (bloom, table and sort mode; extsort's blocks),
+	// and false positive rate of the filter (bloom mode)
+	unsigned long elems;
+	double fpr;
+	// store step numbers instead of preimages and keep the chains' values
+	// every this many steps to replay them from, 0 for preimages (bloom mode)
+	unsigned long index;
+	// seconds between checkpoints, 0 for none, and whether to continue
+	// from the last one (bloom mode)
+	unsigned int checkpoint_secs;
+	int resume;
+	// seconds between progress reports on stderr, 0 for none, and the
+	// Prometheus text file they also go to, or NULL (bloom mode)
+	unsigned int stats_secs;
+	const char *metrics_path;
+};
+
+// each search mode returns 0 when done (collision found or gave up)
+// and 1 on errors, printing its results along the way
+
+// bloom filter to spot candidates, verified through a store
+int search_bloom(const struct search_options *opts);
+// exact bit-packed in-memory hash table, no false positives
+int search_table(const struct search_options *opts);
+// Brent's cycle finding, constant memory
+int search_brent(const struct search_options *opts);
+// parallel search that only stores distinguished points
+int search_dp(const struct search_options *opts);
+// radix sorted blocks of steps, merged and scanned for equal neighbours
+int search_sort(const struct search_options *opts);
+// the same with the sorted blocks in segment files, merged on disk
+int search_extsort(const struct search_options *opts);
+// bloom mode with the hashing on other threads, fed through ring buffers
+int search_pipe(const struct search_options *opts);
+
+#endif //SEARCH_H
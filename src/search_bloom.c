@@ -0,0 +1,556 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chain.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "phase.h"
+#include "search.h"
+#include "stats.h"
+#include "store.h"
+
+#define CHECKPOINT_FILE "shacollider.ckpt"
+#define CHECKPOINT_MAGIC 0x53484143
+#define CHECKPOINT_VERSION 5
+// how many steps to go between looking at the clock
+#define CHECKPOINT_CHECK_STEPS 65536
+// store puts timed for the stats, one in this many (plus one); gets are
+// rare enough to time them all
+#define STATS_PUT_SAMPLE 63
+// with --index, the stored step numbers have room for this many times
+// (as a power of two) the steps a collision is expected after
+#define INDEX_HEADROOM_BITS 8
+
+
+// everything needed to continue a run, besides the filter (which follows
+// it in the checkpoint file, unless it has a file of its own) and the
+// store; written as is, so a checkpoint can only be resumed by the same build
+struct bloom_state {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int bitlen;
+	unsigned int chains;
+	unsigned long elems;
+	double fpr;
+	unsigned long index;
+	int filter_file;
+	char store[16];
+	char filter[16];
+	unsigned long long steps;
+	unsigned long long dbqueries;
+	unsigned long long chain_steps[MAX_CHAINS];
+	unsigned long long chain_queries[MAX_CHAINS];
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+};
+
+// with --index the store only keeps step numbers, and the chains' values
+// every index steps are kept here to replay the preimages from: all
+// chains' values of a round one after the other, hashlen bytes each
+struct snapshots {
+	unsigned char *values;
+	size_t rounds;
+	size_t size;
+};
+
+static volatile sig_atomic_t interrupted;
+
+
+static void on_signal(int sig) {
+	interrupted = 1;
+}
+
+static FILE *load_state(struct bloom_state *st, const struct search_options *opts) {
+	// reads the walk state, leaves the file open for the filter
+	FILE *f = fopen(CHECKPOINT_FILE, "rb");
+
+	if (f == NULL) {
+		printf("No checkpoint (%s) to resume from.\n", CHECKPOINT_FILE);
+		return NULL;
+	}
+
+	if (fread(st, sizeof(*st), 1, f) != 1 || st->magic != CHECKPOINT_MAGIC ||
+			st->version != CHECKPOINT_VERSION || st->bitlen != bitlen) {
+		printf("%s is not a checkpoint of this %u-bit search.\n",
+				CHECKPOINT_FILE, bitlen);
+		fclose(f);
+		return NULL;
+	}
+	if (st->index != opts->index) {
+		printf("The checkpoint was taken storing %s.\n",
+				st->index ? "step numbers (--index)" : "preimages");
+		fclose(f);
+		return NULL;
+	}
+	if (st->filter_file != (opts->filter_file != NULL)) {
+		printf("The checkpoint was taken with the filter %s.\n",
+				st->filter_file ? "in a file (--filter-file)" : "in memory");
+		fclose(f);
+		return NULL;
+	}
+	if (st->elems != opts->elems || st->fpr != opts->fpr) {
+		printf("The checkpoint was taken sized for %lu elems @ %f FP probability.\n",
+				st->elems, st->fpr);
+		fclose(f);
+		return NULL;
+	}
+	if (st->chains != opts->chains ||
+			strncmp(st->store, opts->store->name, sizeof(st->store)) != 0 ||
+			strncmp(st->filter, opts->filter->name, sizeof(st->filter)) != 0) {
+		printf("The checkpoint was taken walking %u chain(s) with the %s store "
+				"and %s filter.\n", st->chains, st->store, st->filter);
+		fclose(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+static int snapshots_add(struct snapshots *snaps, unsigned int chains,
+		unsigned char (*prev)[SHA256_HASH_SIZE]) {
+	size_t round = chains * hashlen;
+
+	if (snaps->rounds == snaps->size) {
+		size_t size = snaps->size ? 2 * snaps->size : 64;
+		unsigned char *values = realloc(snaps->values, size * round);
+
+		if (values == NULL) {
+			return 1;
+		}
+		snaps->values = values;
+		snaps->size = size;
+	}
+	for (unsigned int c = 0; c < chains; c++) {
+		memcpy(snaps->values + snaps->rounds * round + c * hashlen, prev[c],
+				hashlen);
+	}
+	snaps->rounds++;
+
+	return 0;
+}
+
+static int snapshots_save(const struct snapshots *snaps, unsigned int chains,
+		FILE *f) {
+	return fwrite(&snaps->rounds, sizeof(snaps->rounds), 1, f) != 1 ||
+			fwrite(snaps->values, chains * hashlen, snaps->rounds, f) !=
+					snaps->rounds;
+}
+
+static int snapshots_load(struct snapshots *snaps, unsigned int chains,
+		FILE *f) {
+	size_t rounds;
+
+	if (fread(&rounds, sizeof(rounds), 1, f) != 1) {
+		return 1;
+	}
+	snaps->values = malloc(rounds * chains * hashlen);
+	if (snaps->values == NULL) {
+		return 1;
+	}
+	snaps->rounds = snaps->size = rounds;
+
+	return fread(snaps->values, chains * hashlen, rounds, f) != rounds;
+}
+
+static void replay(unsigned long long step, unsigned int chains,
+		const struct snapshots *snaps, unsigned long every,
+		unsigned char *prev) {
+	// like chain_replay(), but from the latest snapshot before the step
+	unsigned int c = (step - 1) % chains;
+	unsigned long long pos = (step - 1) / chains;
+	unsigned char next[SHA256_HASH_SIZE];
+
+	memcpy(prev, snaps->values + (pos / every * chains + c) * hashlen, hashlen);
+	for (unsigned long long i = pos % every; i > 0; i--) {
+		chain_step(prev, next);
+		memcpy(prev, next, hashlen);
+	}
+}
+
+static int save_checkpoint(const struct bloom_state *st, struct store *store,
+		struct filter *filter, const struct snapshots *snaps) {
+	// the store (and a filter in a file of its own) has to have
+	// everything the checkpoint covers first; having more doesn't hurt,
+	// the resumed walk puts the same records
+	if (store->ops->sync(store) ||
+			(st->filter_file && filter->ops->sync(filter))) {
+		return 1;
+	}
+
+	FILE *f = checkpoint_begin(CHECKPOINT_FILE);
+	if (f == NULL) {
+		return 1;
+	}
+	if (fwrite(st, sizeof(*st), 1, f) != 1 ||
+			(!st->filter_file && filter->ops->save(filter, f)) ||
+			(st->index && snapshots_save(snaps, st->chains, f))) {
+		checkpoint_abort(f, CHECKPOINT_FILE);
+		return 1;
+	}
+
+	return checkpoint_commit(f, CHECKPOINT_FILE);
+}
+
+int search_bloom(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char other[SHA256_HASH_SIZE + 1];
+	unsigned char step_val[sizeof(unsigned long long)];
+	struct bloom_state st = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.bitlen = bitlen,
+		.chains = chains,
+		.elems = opts->elems,
+		.fpr = opts->fpr,
+		.index = opts->index,
+		.filter_file = opts->filter_file != NULL,
+		.steps = 1,
+	};
+	struct snapshots snaps = { 0 };
+	// bytes per stored step number, or 0 to store the preimages
+	size_t step_bytes = 0;
+	unsigned char (*prev)[SHA256_HASH_SIZE] = st.prev;
+	FILE *resume = NULL;
+	int checkpoints = opts->checkpoint_secs > 0;
+
+	strncpy(st.store, opts->store->name, sizeof(st.store) - 1);
+	strncpy(st.filter, opts->filter->name, sizeof(st.filter) - 1);
+	if (opts->resume) {
+		resume = load_state(&st, opts);
+		if (resume == NULL) {
+			return 1;
+		}
+	} else {
+		checkpoint_remove(CHECKPOINT_FILE);
+		for (unsigned int c = 0; c < chains; c++) {
+			chain_seed(c, prev[c]);
+		}
+	}
+
+	if (checkpoints && opts->store->sync == NULL) {
+		printf("The %s store doesn't survive restarts, not checkpointing.\n",
+				opts->store->name);
+		checkpoints = 0;
+	}
+
+	// storage to verify bloom filter hits with, maps the trimmed
+	// hashes to their preimages plus the chain they came from, or with
+	// --index to the step number the preimage can be replayed from
+	if (opts->index) {
+		step_bytes = (bitlen / 2 + INDEX_HEADROOM_BITS + 7) / 8;
+		step_bytes = step_bytes < sizeof(step_val) ? step_bytes : sizeof(step_val);
+		printf("Storing %zu-byte step numbers instead of %zu-byte preimages, "
+				"snapshots every %lu steps.\n", step_bytes, hashlen + 1,
+				opts->index);
+	}
+	struct store store;
+	if (store_open(&store, opts->store, hashlen,
+			step_bytes ? step_bytes : hashlen + 1, opts->elems, opts->resume)) {
+		printf("Failed to set up the %s store.\n", opts->store->name);
+		if (resume != NULL) {
+			fclose(resume);
+		}
+		return 1;
+	}
+
+	// filter for efficient in-memory collision detection
+	struct filter filter;
+	printf("Setting up %s filter for %.1fM elems @ %f FP probability.\n",
+			opts->filter->name, (double) opts->elems / 1000000, opts->fpr);
+	uint64_t start = stats_now_ns();
+	// only the store resumed with knows the keys left in the file, a
+	// fresh one would make all of them false positives
+	if (filter_init(&filter, opts->filter, bitlen, opts->elems, opts->fpr,
+			opts->filter_file, resume != NULL)) {
+		store.ops->close(&store, opts->resume);
+		if (resume != NULL) {
+			fclose(resume);
+		}
+		return 1;
+	}
+	if (filter.attached) {
+		printf("Picked up the filter in %s in %.1f ms, keeping its keys.\n",
+				opts->filter_file, (stats_now_ns() - start) / 1e6);
+	} else if (resume != NULL && st.filter_file) {
+		printf("The filter file %s is gone, can't resume.\n",
+				opts->filter_file);
+		// the empty one just made would look like the real thing later
+		filter.ops->free(&filter);
+		remove(opts->filter_file);
+		store.ops->close(&store, 1);
+		fclose(resume);
+		return 1;
+	}
+
+	if (resume != NULL) {
+		int ret = (!st.filter_file && filter.ops->load(&filter, resume)) ||
+				(opts->index && snapshots_load(&snaps, chains, resume));
+
+		fclose(resume);
+		if (ret) {
+			printf("Failed to read the filter from %s.\n", CHECKPOINT_FILE);
+			free(snaps.values);
+			filter.ops->free(&filter);
+			store.ops->close(&store, 1);
+			return 1;
+		}
+		printf("Resuming after %llu iterations.\n", st.steps - 1);
+	}
+	printf("Filter using %.2f MB.\n",
+			(double) filter.ops->bytes(&filter) / 1024 / 1024);
+
+	// a restart or ^C gets a last checkpoint to resume from
+	if (checkpoints) {
+		struct sigaction sa = { .sa_handler = on_signal };
+
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+	}
+
+	struct stats stats;
+	struct stats_sample sample = { .filter = &filter };
+	stats_init(&stats, opts->stats_secs, opts->metrics_path, "bloom", st.steps - 1);
+
+	unsigned long long *chain_steps = st.chain_steps;
+	unsigned long long *chain_queries = st.chain_queries;
+	unsigned long long next_check = st.steps + CHECKPOINT_CHECK_STEPS;
+	time_t next_checkpoint = time(NULL) + opts->checkpoint_secs;
+	int found = 0, failed = 0;
+	while (!found && !failed && !interrupted) {
+		// rounds start with all chains the same number of steps in
+		if (opts->index && chain_steps[0] == snaps.rounds * opts->index &&
+				snapshots_add(&snaps, chains, prev)) {
+			printf("Failed to allocate memory for snapshots!\n");
+			failed = 1;
+			break;
+		}
+
+		// calculate hashes of the first bitlen bits of data for all
+		// chains at once, so their compressions can overlap
+		// (always fits into a single block, so skip the context)
+		PHASE_BEGIN(PHASE_HASH);
+		sha256_short_many(prev, SHA256_HASH_SIZE, bitlen, chains, hash[0]);
+		PHASE_END(PHASE_HASH);
+
+		// trim the hashes and start loading where the filter keeps them,
+		// so the chains' cache misses overlap instead of adding up
+		PHASE_BEGIN(PHASE_TRIM);
+		for (unsigned int c = 0; c < chains; c++) {
+			trim_hash(hash[c]);
+		}
+		filter_prefetch_many(&filter, hash[0], SHA256_HASH_SIZE, chains);
+		PHASE_END(PHASE_TRIM);
+
+		for (unsigned int c = 0; c < chains; c++) {
+			size_t len = hashlen;
+
+			chain_steps[c]++;
+
+#ifdef DEBUG
+			// debug print
+			printf("%u: ", c);
+			print_hex(hash[c], len);
+			printf("\n");
+#endif //DEBUG
+
+			// check if the filter already (probably) contains the hash,
+			// adding it in the same go if the filter can
+			int full = 0;
+			PHASE_BEGIN(PHASE_FILTER_CHECK);
+			int maybe = filter.ops->test_and_add ?
+					filter.ops->test_and_add(&filter, hash[c], &full) :
+					filter.ops->check(&filter, hash[c]);
+			PHASE_END(PHASE_FILTER_CHECK);
+			if (maybe) {
+#ifdef DEBUG
+				printf("Found possible collision after %llu iterations :: ", st.steps);
+				print_hex(hash[c], len);
+				printf("\n");
+#endif
+
+				// need to make sure it wasn't a false positive
+				// by searching for the hash in the store
+				// if it's not found then continue, else break
+				uint64_t t = stats_now_ns();
+				PHASE_BEGIN(PHASE_STORE_GET);
+				int ret = store.ops->get(&store, hash[c], other);
+				PHASE_END(PHASE_STORE_GET);
+
+				latency_add(&stats.get, stats_now_ns() - t);
+
+				if (ret < 0) {
+					printf("Store read fail!\n");
+					failed = 1;
+					break;
+				}
+
+				if (ret == 1 && step_bytes) {
+					// other only has the step number, rebuild its
+					// preimage (and the chain) from it
+					unsigned long long step = 0;
+
+					for (size_t i = step_bytes; i > 0; i--) {
+						step = step << 8 | other[i - 1];
+					}
+					replay(step, chains, &snaps, opts->index, other);
+					other[len] = (step - 1) % chains;
+				}
+
+				if (ret == 0) {
+					// not found
+#ifdef DEBUG
+					printf("Candidate collision hash was a false positive.\n");
+#endif
+					st.dbqueries++;
+					chain_queries[c]++;
+				} else if (memcmp(other, prev[c], len) == 0) {
+					// same preimage, ie. this chain ran into a value
+					// another chain started from; not a collision
+				} else {
+#ifdef DEBUG
+					printf("The store confirmed the collision! \\o/\n");
+#endif
+					double fpr = (double) st.dbqueries / st.steps;
+					printf("Found %u-bit collision after %llu iterations :: ",
+							bitlen, st.steps);
+					print_hex(hash[c], len);
+					printf("\n");
+					printf("Data with the same hash:\n");
+					printf("\t");
+					print_hex(other, len);
+					printf(" (chain %u)\n\t", other[len]);
+					print_hex(prev[c], len);
+					printf(" (chain %u)\n", c);
+					printf("Extra queries to the store: %llu (%f real FPR).\n",
+							st.dbqueries, fpr);
+					found = 1;
+					break;
+				}
+			}
+
+			// add the trimmed hash to the filter
+			if (filter.ops->test_and_add == NULL) {
+				PHASE_BEGIN(PHASE_FILTER_ADD);
+				full = filter.ops->add(&filter, hash[c]);
+				PHASE_END(PHASE_FILTER_ADD);
+			}
+			// ...and to the store, along with the chain it came from
+			// (or just the step number, little endian)
+			prev[c][len] = c;
+			for (size_t i = 0; i < step_bytes; i++) {
+				step_val[i] = st.steps >> (8 * i);
+			}
+			if (step_bytes && step_bytes < sizeof(step_val) &&
+					st.steps >> (8 * step_bytes)) {
+				printf("Step numbers exceeded %zu bytes, exiting.\n", step_bytes);
+				found = 1;
+				break;
+			}
+			uint64_t t = (st.steps & STATS_PUT_SAMPLE) ? 0 : stats_now_ns();
+			PHASE_BEGIN(PHASE_STORE_PUT);
+			int err = store.ops->put(&store, hash[c], step_bytes ? step_val : prev[c]);
+			PHASE_END(PHASE_STORE_PUT);
+			if (err) {
+				printf("Store write fail!\n");
+				failed = 1;
+				break;
+			}
+			if (t) {
+				latency_add(&stats.put, stats_now_ns() - t);
+			}
+			// current -> prev
+			memcpy(prev[c], hash[c], len);
+
+			if (full) {
+				printf("Filter capacity exceeded, exiting.\n");
+				found = 1;
+				break;
+			} else {
+				// rinse and repeat
+				st.steps++;
+			}
+		}
+
+		// checkpoints only ever happen between whole rounds, when
+		// all chains are the same number of steps in
+		if (!found && !failed && st.steps >= next_check) {
+			next_check = st.steps + CHECKPOINT_CHECK_STEPS;
+			if (checkpoints && time(NULL) >= next_checkpoint) {
+				next_checkpoint = time(NULL) + opts->checkpoint_secs;
+				if (save_checkpoint(&st, &store, &filter, &snaps)) {
+					printf("Failed to write checkpoint %s!\n", CHECKPOINT_FILE);
+				} else {
+#ifdef DEBUG
+					printf("Checkpoint after %llu iterations.\n", st.steps - 1);
+#endif
+				}
+			}
+
+			sample.steps = st.steps - 1;
+			sample.queries = st.dbqueries;
+			stats_tick(&stats, &sample);
+		}
+	}
+
+	if (opts->stats_secs > 0) {
+		sample.steps = st.steps - 1;
+		sample.queries = st.dbqueries;
+		stats_report(&stats, &sample);
+	}
+
+	if (failed) {
+		// in the middle of a round and with the store broken there's
+		// nothing to checkpoint, but the last checkpoint still goes
+		// with the store and the filter file as they are kept here
+		filter.ops->free(&filter);
+		free(snaps.values);
+		store.ops->close(&store, 1);
+		if (checkpoints) {
+			printf("Run again with --resume to continue from the last "
+					"checkpoint, if there was one.\n");
+		}
+		return 1;
+	}
+
+	if (interrupted && !found) {
+		// keep the store for --resume
+		int ret = save_checkpoint(&st, &store, &filter, &snaps);
+
+		filter.ops->free(&filter);
+		free(snaps.values);
+		if (store.ops->close(&store, 1) || ret) {
+			printf("Failed to write checkpoint %s!\n", CHECKPOINT_FILE);
+			return 1;
+		}
+		printf("Interrupted after %llu iterations, run again with --resume "
+				"to continue.\n", st.steps - 1);
+		return 0;
+	}
+
+	if (chains > 1) {
+		for (unsigned int c = 0; c < chains; c++) {
+			printf("Chain %u: %llu steps, %llu extra queries to the store.\n",
+					c, chain_steps[c], chain_queries[c]);
+		}
+	}
+
+	printf("Filter using %.2f MB.\n",
+			(double) filter.ops->bytes(&filter) / 1024 / 1024);
+	if (opts->index) {
+		printf("Snapshots using %.2f MB.\n",
+				(double) snaps.rounds * chains * hashlen / 1024 / 1024);
+	}
+	filter.ops->free(&filter);
+	free(snaps.values);
+
+	// the run is over, nothing to resume anymore
+	checkpoint_remove(CHECKPOINT_FILE);
+	if (store.ops->close(&store, 0)) {
+		return 1;
+	}
+
+	return 0;
+}
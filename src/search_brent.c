@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include "chain.h"
+#include "search.h"
+
+// Brent's cycle finding on the walk x -> trim(sha256(x)): every chain
+// eventually runs into a cycle, and the value where the tail joins the
+// cycle has two different preimages, which is the collision we're after.
+// Needs no storage at all, at the cost of walking the chain about twice.
+
+
+// hash all given chains one step further, in place
+static void step_many(unsigned char (*x)[SHA256_HASH_SIZE], unsigned int n) {
+	unsigned char next[MAX_CHAINS][SHA256_HASH_SIZE];
+
+	sha256_short_many(x, SHA256_HASH_SIZE, bitlen, n, next[0]);
+	for (unsigned int c = 0; c < n; c++) {
+		trim_hash(next[c]);
+		memcpy(x[c], next[c], hashlen);
+	}
+}
+
+int search_brent(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned long long seeds = chains;
+	unsigned char seed[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char tortoise[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char hare[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned long long power[MAX_CHAINS], lam[MAX_CHAINS];
+	unsigned long long steps = 0;
+
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(c, seed[c]);
+	}
+
+	for (;;) {
+		// phase 1: find the cycle length of any of the chains, the
+		// tortoise teleports to the hare at every power of two
+		unsigned int c;
+
+		for (c = 0; c < chains; c++) {
+			memcpy(tortoise[c], seed[c], SHA256_HASH_SIZE);
+			memcpy(hare[c], seed[c], SHA256_HASH_SIZE);
+			power[c] = lam[c] = 1;
+		}
+		step_many(hare, chains);
+		steps += chains;
+
+		for (;;) {
+			for (c = 0; c < chains; c++) {
+				if (hash_equal(tortoise[c], hare[c])) {
+					break;
+				}
+				if (power[c] == lam[c]) {
+					memcpy(tortoise[c], hare[c], hashlen);
+					power[c] *= 2;
+					lam[c] = 0;
+				}
+			}
+			if (c < chains) {
+				break;
+			}
+
+			step_many(hare, chains);
+			steps += chains;
+			for (c = 0; c < chains; c++) {
+				lam[c]++;
+			}
+		}
+
+		// phase 2: start over with the hare a cycle length ahead, the
+		// first value they agree on is the start of the cycle and the
+		// values just before it are the two colliding preimages
+		unsigned char pair[2][SHA256_HASH_SIZE];
+		unsigned char last[2][SHA256_HASH_SIZE];
+		unsigned long long mu = 0;
+
+		memcpy(pair[0], seed[c], SHA256_HASH_SIZE);
+		memcpy(pair[1], seed[c], SHA256_HASH_SIZE);
+		for (unsigned long long i = 0; i < lam[c]; i++) {
+			step_many(&pair[1], 1);
+		}
+		steps += lam[c];
+
+		while (!hash_equal(pair[0], pair[1])) {
+			memcpy(last, pair, sizeof(last));
+			step_many(pair, 2);
+			steps += 2;
+			mu++;
+		}
+
+		if (mu > 0) {
+			printf("Found %u-bit collision after %llu iterations :: ",
+					bitlen, steps);
+			print_hex(pair[0], hashlen);
+			printf("\n");
+			printf("Data with the same hash:\n");
+			printf("\t");
+			print_hex(last[0], hashlen);
+			printf("\n\t");
+			print_hex(last[1], hashlen);
+			printf("\n");
+			printf("Chain %u: tail length %llu, cycle length %llu.\n",
+					c, mu, lam[c]);
+			return 0;
+		}
+
+		// the seed itself lies on the cycle, so there's no tail and
+		// nothing collides; give that chain a fresh seed and start
+		// over (with all chains, but this is rare enough)
+#ifdef DEBUG
+		printf("Chain %u has no tail, reseeding.\n", c);
+#endif
+		chain_seed(seeds++, seed[c]);
+	}
+}
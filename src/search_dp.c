@@ -0,0 +1,283 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chain.h"
+#include "mem.h"
+#include "search.h"
+
+// Parallel collision search with distinguished points (van Oorschot and
+// Wiener): every thread walks trails from fresh seeds until it reaches a
+// point whose first dp_bits bits are zero and only that point is stored,
+// along with where its trail started and how long it was. Two trails
+// ending in the same distinguished point have merged somewhere, so
+// replaying both from their starts finds the colliding pair.
+
+// trails longer than this many times the expected length probably
+// went round in a cycle without distinguished points and are dropped
+#define MAX_TRAIL_FACTOR 20
+// more distinguishing bits than this make MAX_TRAIL_FACTOR times the
+// expected trail length overflow, and are way beyond any feasible search
+#define DP_BITS_MAX 48
+// initial number of slots of the distinguished point table
+#define DP_TABLE_SLOTS 4096
+
+
+struct dp_entry {
+	uint64_t key;
+	// seed number and length of the trail ending here, 0 = free slot
+	unsigned long long start;
+	unsigned long long len;
+};
+
+struct dp_search {
+	unsigned int chains;
+	unsigned int dp_bits;
+	// bits of the keys from hash_key(), ie. at most 64
+	unsigned int key_bits;
+	unsigned long long max_len;
+
+	// distinguished point table, open addressing with linear probing
+	pthread_mutex_t lock;
+	struct dp_entry *table;
+	size_t slots;
+	size_t used;
+
+	atomic_ullong next_seed;
+	atomic_ullong steps;
+	atomic_int found;
+	atomic_int error;
+
+	// the result, set by whichever thread resolved it first
+	unsigned char hash[SHA256_HASH_SIZE];
+	unsigned char a[SHA256_HASH_SIZE];
+	unsigned char b[SHA256_HASH_SIZE];
+};
+
+
+static int dp_insert(struct dp_search *s, uint64_t key, unsigned long long start,
+		unsigned long long len, struct dp_entry *old) {
+	// store the trail ending in the given distinguished point, or if
+	// there already is one return it in old and return 1
+	pthread_mutex_lock(&s->lock);
+
+	if (s->used * 2 >= s->slots) {
+		size_t slots = s->slots * 2;
+		struct dp_entry *table = mem_alloc(slots * sizeof(*table));
+
+		if (table == NULL) {
+			atomic_store(&s->error, 1);
+			pthread_mutex_unlock(&s->lock);
+			return 0;
+		}
+		for (size_t i = 0; i < s->slots; i++) {
+			if (s->table[i].len) {
+				size_t j = s->table[i].key & (slots - 1);
+				while (table[j].len) {
+					j = (j + 1) & (slots - 1);
+				}
+				table[j] = s->table[i];
+			}
+		}
+		mem_free(s->table);
+		s->table = table;
+		s->slots = slots;
+	}
+
+	// the low bits of the key are as random as it gets
+	size_t i = key & (s->slots - 1);
+	while (s->table[i].len) {
+		if (s->table[i].key == key) {
+			*old = s->table[i];
+			pthread_mutex_unlock(&s->lock);
+			return 1;
+		}
+		i = (i + 1) & (s->slots - 1);
+	}
+
+	s->table[i].key = key;
+	s->table[i].start = start;
+	s->table[i].len = len;
+	s->used++;
+
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+static int dp_resolve(struct dp_search *s, const struct dp_entry *x,
+		const struct dp_entry *y) {
+	// replay two trails ending in the same distinguished point; once
+	// they are the same distance away from it they move in lock-step
+	// until they meet, the values just before that collide
+	unsigned char a[SHA256_HASH_SIZE], b[SHA256_HASH_SIZE];
+	unsigned char na[SHA256_HASH_SIZE], nb[SHA256_HASH_SIZE];
+	unsigned long long alen = x->len, blen = y->len;
+
+	chain_seed(x->start, a);
+	chain_seed(y->start, b);
+	for (; alen > blen; alen--) {
+		chain_step(a, na);
+		memcpy(a, na, hashlen);
+	}
+	for (; blen > alen; blen--) {
+		chain_step(b, nb);
+		memcpy(b, nb, hashlen);
+	}
+
+	if (hash_equal(a, b)) {
+		// one trail started on the other one, nothing collides
+		return 0;
+	}
+
+	for (;;) {
+		chain_step(a, na);
+		chain_step(b, nb);
+		if (hash_equal(na, nb)) {
+			break;
+		}
+		memcpy(a, na, hashlen);
+		memcpy(b, nb, hashlen);
+	}
+
+	if (atomic_exchange(&s->found, 1) == 0) {
+		memcpy(s->hash, na, hashlen);
+		memcpy(s->a, a, hashlen);
+		memcpy(s->b, b, hashlen);
+	}
+
+	return 1;
+}
+
+static void *dp_worker(void *arg) {
+	struct dp_search *s = arg;
+	unsigned int chains = s->chains;
+	unsigned char x[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char next[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned long long start[MAX_CHAINS], len[MAX_CHAINS];
+	unsigned long long steps = 0;
+	unsigned int shift = s->key_bits - s->dp_bits;
+
+	mem_pin_thread();
+	// every thread walks its own trails, several at once for the
+	// multi-buffer kernels
+	for (unsigned int c = 0; c < chains; c++) {
+		start[c] = atomic_fetch_add(&s->next_seed, 1);
+		chain_seed(start[c], x[c]);
+		len[c] = 0;
+	}
+
+	while (!atomic_load_explicit(&s->found, memory_order_relaxed) &&
+			!atomic_load_explicit(&s->error, memory_order_relaxed)) {
+		sha256_short_many(x, SHA256_HASH_SIZE, bitlen, chains, next[0]);
+		steps += chains;
+
+		for (unsigned int c = 0; c < chains; c++) {
+			trim_hash(next[c]);
+			memcpy(x[c], next[c], hashlen);
+			len[c]++;
+
+			uint64_t key = hash_key(x[c]);
+			if ((key >> shift) == 0) {
+				struct dp_entry old;
+
+				if (dp_insert(s, key, start[c], len[c], &old)) {
+					struct dp_entry cur = { key, start[c], len[c] };
+					if (old.start != start[c] && dp_resolve(s, &old, &cur)) {
+						break;
+					}
+				}
+			} else if (len[c] < s->max_len) {
+				continue;
+			}
+
+			// distinguished point reached or trail given up on,
+			// start a new one
+			start[c] = atomic_fetch_add(&s->next_seed, 1);
+			chain_seed(start[c], x[c]);
+			len[c] = 0;
+		}
+
+		if (steps >= 1UL << 16) {
+			atomic_fetch_add(&s->steps, steps);
+			steps = 0;
+		}
+	}
+
+	atomic_fetch_add(&s->steps, steps);
+	return NULL;
+}
+
+int search_dp(const struct search_options *opts) {
+	struct dp_search s = { .chains = opts->chains };
+	unsigned int threads = opts->threads;
+
+	// about 2^(bitlen/2) steps are needed in total, so with a quarter
+	// of the bits there are still plenty of distinguished points
+	unsigned int max_bits = bitlen < DP_BITS_MAX ? bitlen : DP_BITS_MAX;
+
+	s.key_bits = bitlen < 64 ? bitlen : 64;
+	s.dp_bits = opts->dp_bits ? opts->dp_bits : bitlen / 4;
+	if (!opts->dp_bits && s.dp_bits >= max_bits) {
+		s.dp_bits = max_bits - 1;
+	}
+	if (s.dp_bits >= max_bits) {
+		printf("Distinguishing bits must be less than %u.\n", max_bits);
+		return 1;
+	}
+	s.max_len = (unsigned long long) MAX_TRAIL_FACTOR << s.dp_bits;
+
+	s.slots = DP_TABLE_SLOTS;
+	s.table = mem_alloc(s.slots * sizeof(*s.table));
+	if (s.table == NULL) {
+		printf("Failed to allocate the distinguished point table.\n");
+		return 1;
+	}
+	pthread_mutex_init(&s.lock, NULL);
+	atomic_init(&s.next_seed, 0);
+	atomic_init(&s.steps, 0);
+	atomic_init(&s.found, 0);
+	atomic_init(&s.error, 0);
+
+	printf("Walking trails on %u thread(s) up to %u-bit distinguished points.\n",
+			threads, s.dp_bits);
+
+	pthread_t *tid = calloc(threads, sizeof(*tid));
+	unsigned int started;
+	for (started = 0; tid && started < threads; started++) {
+		if (pthread_create(&tid[started], NULL, dp_worker, &s)) {
+			break;
+		}
+	}
+	if (started < threads) {
+		printf("Failed to start worker threads.\n");
+		atomic_store(&s.error, 1);
+	}
+	for (unsigned int t = 0; t < started; t++) {
+		pthread_join(tid[t], NULL);
+	}
+	free(tid);
+
+	int error = atomic_load(&s.error);
+	if (!error) {
+		printf("Found %u-bit collision after %llu iterations :: ",
+				bitlen, (unsigned long long) atomic_load(&s.steps));
+		print_hex(s.hash, hashlen);
+		printf("\n");
+		printf("Data with the same hash:\n");
+		printf("\t");
+		print_hex(s.a, hashlen);
+		printf("\n\t");
+		print_hex(s.b, hashlen);
+		printf("\n");
+		printf("Distinguished points stored: %zu (%.2f MB).\n",
+				s.used, (double) s.slots * sizeof(*s.table) / 1024 / 1024);
+	} else if (started == threads) {
+		printf("Failed to grow the distinguished point table.\n");
+	}
+
+	pthread_mutex_destroy(&s.lock);
+	mem_free(s.table);
+
+	return error;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "chain.h"
+#include "search.h"
+#include "segment.h"
+#include "sort.h"
+
+// Out-of-core version of the sort search for walks that don't fit into
+// memory: every block of steps is radix sorted in memory and written out
+// as a segment file, and once the new segments add up to half of the
+// records merged so far (or a block, at first), they're merged with them
+// into a single segment on disk, k-way and in one sequential pass, while
+// equal neighbours are collected as collision candidates. The records
+// are rewritten about three times over a whole run, so it goes at the
+// speed of the disk rather than of random lookups. Memory is two blocks
+// (one to sort in) plus a few I/O buffers per segment; disk needs room
+// for the records twice, the old and the new merged segment.
+
+// the segments go into a fresh directory of their own, so runs sharing
+// a working directory don't overwrite each other's
+#define SEGMENT_DIR "shasort.XXXXXX"
+
+
+static void segment_path(const char *dir, unsigned int id, char *path,
+		size_t len) {
+	snprintf(path, len, "%s/%u", dir, id);
+}
+
+int search_extsort(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned int key_bits = bitlen < 64 ? bitlen : 64;
+	size_t block_len = opts->elems - opts->elems % chains;
+	struct sort_pairs candidates = { 0 };
+	unsigned long long steps = 1;
+	int found = 0, ret = 0;
+
+	// the merged segment and the ones written since, all in step order
+	unsigned int *ids = NULL;
+	unsigned int num_ids = 0, next_id = 0;
+	int have_base = 0;
+	size_t base_records = 0, new_records = 0;
+	char dir[] = SEGMENT_DIR;
+
+	if (block_len == 0) {
+		printf("Blocks need room for at least one step per chain.\n");
+		return 1;
+	}
+	// the block and the radix sort's scratch space
+	struct sort_record *block = malloc(2 * block_len * sizeof(*block));
+	if (block == NULL) {
+		printf("Failed to allocate a block of %zu records.\n", block_len);
+		return 1;
+	}
+
+	if (mkdtemp(dir) == NULL) {
+		printf("Failed to create a directory for the segments!\n");
+		free(block);
+		return 1;
+	}
+
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(c, prev[c]);
+	}
+
+	printf("Writing sorted segments of %.1fM steps (%.2f MB to sort them) "
+			"to %s/\n", (double) block_len / 1000000,
+			(double) 2 * block_len * sizeof(*block) / 1024 / 1024, dir);
+
+	while (!found) {
+		char path[64];
+
+		sort_fill_block(block, block_len, chains, prev, &steps);
+
+		unsigned int *more = realloc(ids, (num_ids + 2) * sizeof(*ids));
+		if (more == NULL || sort_records(block, block + block_len, block_len, key_bits)) {
+			printf("Failed to allocate memory for sorting.\n");
+			ids = more ? more : ids;
+			ret = 1;
+			break;
+		}
+		ids = more;
+
+		struct segment_writer w;
+		segment_path(dir, next_id, path, sizeof(path));
+		if (segment_create(&w, path)) {
+			printf("Failed to create segment %s!\n", path);
+			ret = 1;
+			break;
+		}
+		ids[num_ids++] = next_id++;
+		if (segment_append(&w, block, block_len) | segment_finish(&w)) {
+			printf("Failed to write segment %s!\n", path);
+			ret = 1;
+			break;
+		}
+		new_records += block_len;
+
+		if (new_records < block_len || new_records < base_records / 2) {
+			continue;
+		}
+
+		// merge everything into one segment, which becomes the base
+		const char **inputs = calloc(num_ids, sizeof(*inputs));
+		char (*paths)[64] = calloc(num_ids, sizeof(*paths));
+		char out[64];
+		size_t records;
+
+		for (unsigned int i = 0; inputs && paths && i < num_ids; i++) {
+			segment_path(dir, ids[i], paths[i], sizeof(paths[i]));
+			inputs[i] = paths[i];
+		}
+		segment_path(dir, next_id, out, sizeof(out));
+		if (inputs == NULL || paths == NULL ||
+				segment_merge(inputs, num_ids, have_base, out, &candidates,
+						&records)) {
+			printf("Failed to merge segments into %s!\n", out);
+			free(inputs);
+			free(paths);
+			unlink(out);
+			ret = 1;
+			break;
+		}
+		for (unsigned int i = 0; i < num_ids; i++) {
+			unlink(paths[i]);
+		}
+		free(inputs);
+		free(paths);
+		ids[0] = next_id++;
+		num_ids = 1;
+		have_base = 1;
+		base_records = records;
+		new_records = 0;
+
+		found = sort_resolve_candidates(&candidates, chains);
+	}
+
+	if (ret == 0) {
+		printf("Merged segments using %.2f MB on disk.\n",
+				(double) base_records * sizeof(*block) / 1024 / 1024);
+	}
+
+	// the segments are only good for this run
+	for (unsigned int i = 0; i < num_ids; i++) {
+		char path[64];
+
+		segment_path(dir, ids[i], path, sizeof(path));
+		unlink(path);
+	}
+	rmdir(dir);
+	free(ids);
+	free(block);
+	free(candidates.pairs);
+
+	return ret;
+}
@@ -0,0 +1,282 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chain.h"
+#include "filter.h"
+#include "mem.h"
+#include "ring.h"
+#include "search.h"
+#include "stats.h"
+#include "store.h"
+
+// Pipelined version of bloom mode: hashing threads (producers) walk their
+// own chains and push (trimmed hash, preimage, chain) records into one
+// ring buffer each, and the main thread (the consumer) takes them from
+// all rings in batches to check and add them to the filter and store.
+// A slow store only stalls the hashing once the rings are full, and how
+// often and how long that happens is reported as backpressure. The
+// filter and store aren't thread-safe, so there is a single consumer.
+
+// records taken from a ring before its slots are handed back
+#define PIPE_BATCH 256
+// how long the consumer naps when all rings are empty
+#define IDLE_NSEC 50000
+// records between looks at the clock for the stats
+#define STATS_CHECK_STEPS 65536
+// store puts timed for the stats, one in this many (plus one)
+#define STATS_PUT_SAMPLE 63
+// records ahead of the one being checked whose filter memory is prefetched
+#define PIPE_PREFETCH 16
+
+
+struct producer {
+	pthread_t thread;
+	struct ring ring;
+	// chains id * chains to id * chains + chains - 1
+	unsigned int id;
+	unsigned int chains;
+	const atomic_int *stop;
+};
+
+static void *producer_run(void *arg) {
+	struct producer *p = arg;
+	unsigned int chains = p->chains;
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+
+	mem_pin_thread();
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(p->id * chains + c, prev[c]);
+	}
+
+	while (!atomic_load_explicit(p->stop, memory_order_relaxed)) {
+		sha256_short_many(prev, SHA256_HASH_SIZE, bitlen, chains, hash[0]);
+
+		// a whole round at a time, so the rings only see whole rounds
+		if (ring_reserve(&p->ring, chains, p->stop)) {
+			break;
+		}
+		for (unsigned int c = 0; c < chains; c++) {
+			size_t len = trim_hash(hash[c]);
+			unsigned char *rec = ring_put_slot(&p->ring, c);
+
+			memcpy(rec, hash[c], len);
+			memcpy(rec + len, prev[c], len);
+			rec[2 * len] = p->id * chains + c;
+			memcpy(prev[c], hash[c], len);
+		}
+		ring_publish(&p->ring, chains);
+	}
+
+	return NULL;
+}
+
+static void sample_rings(struct producer *producers, unsigned int n,
+		struct stats_sample *x) {
+	x->queued = 0;
+	x->queue_slots = 0;
+	x->stalls = 0;
+	x->stall_secs = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		struct ring *r = &producers[i].ring;
+
+		x->queued += ring_used(r);
+		x->queue_slots += r->slots;
+		x->stalls += atomic_load_explicit(&r->stalls, memory_order_relaxed);
+		x->stall_secs += atomic_load_explicit(&r->stall_ns,
+				memory_order_relaxed) / 1e9;
+	}
+}
+
+int search_pipe(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned int threads = opts->threads;
+	// key, then value: preimage and chain
+	size_t rec_len = 2 * hashlen + 1;
+	unsigned char other[SHA256_HASH_SIZE + 1];
+	unsigned long long steps = 1, queries = 0, idle = 0;
+	atomic_int stop;
+	int found = 0, ret = 0;
+
+	if ((unsigned long) threads * chains > 256) {
+		printf("The chain numbers are stored in a byte, so at most 256 chains "
+				"across all threads.\n");
+		return 1;
+	}
+	if (opts->queue < chains || (opts->queue & (opts->queue - 1))) {
+		printf("The queue needs a power of two slots, at least one per chain.\n");
+		return 1;
+	}
+
+	struct store store;
+	if (store_open(&store, opts->store, hashlen, hashlen + 1, opts->elems, 0)) {
+		printf("Failed to set up the %s store.\n", opts->store->name);
+		return 1;
+	}
+
+	struct filter filter;
+	printf("Setting up %s filter for %.1fM elems @ %f FP probability.\n",
+			opts->filter->name, (double) opts->elems / 1000000, opts->fpr);
+	if (filter_init(&filter, opts->filter, bitlen, opts->elems, opts->fpr,
+			opts->filter_file, 0)) {
+		store.ops->close(&store, 0);
+		return 1;
+	}
+	printf("Filter using %.2f MB.\n",
+			(double) filter.ops->bytes(&filter) / 1024 / 1024);
+
+	struct producer *producers = calloc(threads, sizeof(*producers));
+	unsigned int started = 0;
+
+	atomic_init(&stop, 0);
+	for (; producers != NULL && started < threads; started++) {
+		struct producer *p = &producers[started];
+
+		p->id = started;
+		p->chains = chains;
+		p->stop = &stop;
+		if (ring_init(&p->ring, opts->queue, rec_len)) {
+			break;
+		}
+		if (pthread_create(&p->thread, NULL, producer_run, p)) {
+			ring_free(&p->ring);
+			break;
+		}
+	}
+	if (started < threads) {
+		printf("Failed to start %u hashing threads.\n", threads);
+		found = ret = 1;
+	} else {
+		printf("Hashing on %u thread(s) into %lu-slot queues (%.2f MB).\n",
+				threads, opts->queue,
+				(double) threads * opts->queue * rec_len / 1024 / 1024);
+	}
+
+	struct stats stats;
+	struct stats_sample sample = { .filter = &filter };
+	struct timespec nap = { 0, IDLE_NSEC };
+	stats_init(&stats, opts->stats_secs, opts->metrics_path, "pipe", 0);
+
+	unsigned long long next_check = steps + STATS_CHECK_STEPS;
+	while (!found) {
+		size_t got = 0;
+
+		for (unsigned int i = 0; i < threads && !found; i++) {
+			struct ring *r = &producers[i].ring;
+			size_t n = ring_peek(r, PIPE_BATCH);
+
+			for (size_t j = 0; j < n && j < PIPE_PREFETCH && filter.ops->prefetch; j++) {
+				filter.ops->prefetch(&filter, ring_get_slot(r, j));
+			}
+			for (size_t j = 0; j < n; j++) {
+				const unsigned char *rec = ring_get_slot(r, j);
+
+				if (j + PIPE_PREFETCH < n && filter.ops->prefetch) {
+					filter.ops->prefetch(&filter, ring_get_slot(r, j + PIPE_PREFETCH));
+				}
+				const unsigned char *key = rec, *val = rec + hashlen;
+
+				int full = 0;
+				int maybe = filter.ops->test_and_add ?
+						filter.ops->test_and_add(&filter, key, &full) :
+						filter.ops->check(&filter, key);
+
+				if (maybe) {
+					// verify with the store like bloom mode
+					uint64_t t = stats_now_ns();
+					int hit = store.ops->get(&store, key, other);
+
+					latency_add(&stats.get, stats_now_ns() - t);
+					if (hit < 0) {
+						printf("Store read fail!\n");
+						found = ret = 1;
+						break;
+					}
+
+					if (hit == 0) {
+						queries++;
+					} else if (memcmp(other, val, hashlen) != 0) {
+						printf("Found %u-bit collision after %llu iterations :: ",
+								bitlen, steps);
+						print_hex(key, hashlen);
+						printf("\n");
+						printf("Data with the same hash:\n");
+						printf("\t");
+						print_hex(other, hashlen);
+						printf(" (chain %u)\n\t", other[hashlen]);
+						print_hex(val, hashlen);
+						printf(" (chain %u)\n", val[hashlen]);
+						printf("Extra queries to the store: %llu (%f real FPR).\n",
+								queries, (double) queries / steps);
+						found = 1;
+						break;
+					}
+				}
+
+				if (filter.ops->test_and_add == NULL) {
+					full = filter.ops->add(&filter, key);
+				}
+				uint64_t t = (steps & STATS_PUT_SAMPLE) ? 0 : stats_now_ns();
+				if (store.ops->put(&store, key, val)) {
+					printf("Store write fail!\n");
+					found = ret = 1;
+					break;
+				}
+				if (t) {
+					latency_add(&stats.put, stats_now_ns() - t);
+				}
+				if (full) {
+					printf("Filter capacity exceeded, exiting.\n");
+					found = 1;
+					break;
+				}
+				steps++;
+			}
+			ring_release(r, n);
+			got += n;
+		}
+
+		if (got == 0 && !found) {
+			idle++;
+			nanosleep(&nap, NULL);
+		}
+		if (steps >= next_check) {
+			next_check = steps + STATS_CHECK_STEPS;
+			sample.steps = steps - 1;
+			sample.queries = queries;
+			sample_rings(producers, threads, &sample);
+			stats_tick(&stats, &sample);
+		}
+	}
+
+	atomic_store(&stop, 1);
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+
+	if (started == threads) {
+		sample.steps = steps - 1;
+		sample.queries = queries;
+		sample_rings(producers, threads, &sample);
+		if (opts->stats_secs > 0) {
+			stats_report(&stats, &sample);
+		}
+		printf("Producers waited for room %llu times (%.2f s), the consumer "
+				"for records %llu times.\n", sample.stalls, sample.stall_secs,
+				idle);
+	}
+	for (unsigned int i = 0; i < started; i++) {
+		ring_free(&producers[i].ring);
+	}
+	free(producers);
+
+	filter.ops->free(&filter);
+	if (store.ops->close(&store, 0)) {
+		return 1;
+	}
+
+	return ret;
+}
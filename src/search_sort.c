@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "chain.h"
+#include "search.h"
+#include "sort.h"
+
+// Sort-based batch search: instead of probing a filter on every step,
+// the chains fill a block of (trimmed hash, step number) records, the
+// block is radix sorted on the hash and merged into the sorted records of
+// all earlier blocks, and equal neighbours in the merged run are the
+// collision candidates. All passes over the data are sequential. Like
+// table mode only the step numbers are kept, the preimages of a candidate
+// are found again by replaying the chains.
+
+// blocks hold at least this many records, and at most half the records
+// kept so far, so the merges add up to O(n log n) while a collision is
+// found at most 1.5 times the steps after it happened
+#define SORT_BLOCK_MIN (1UL << 20)
+
+
+// records in the block after a run of run_len, 0 once they don't fit
+static size_t next_block_len(size_t run_len, size_t max_records,
+		unsigned int chains) {
+	size_t block_len = run_len / 2 > SORT_BLOCK_MIN ? run_len / 2 : SORT_BLOCK_MIN;
+
+	if (run_len + block_len > max_records) {
+		block_len = max_records - run_len;
+	}
+	// whole rounds only
+	return block_len - block_len % chains;
+}
+
+int search_sort(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned int key_bits = bitlen < 64 ? bitlen : 64;
+	size_t max_records = opts->elems, max_block = 0, len, n;
+	struct sort_run run = { 0 };
+	struct sort_pairs candidates = { 0 };
+	unsigned long long steps = 1;
+	int found = 0, ret = 0;
+
+	// the block sizes don't depend on the hashes, so the run and the
+	// largest block are allocated once: the blocks are sorted with the
+	// free end of the run as scratch space and merged into it in place
+	for (len = 0; (n = next_block_len(len, max_records, chains)) > 0; len += n) {
+		max_block = n > max_block ? n : max_block;
+	}
+	if (len == 0) {
+		printf("Record capacity exceeded, exiting.\n");
+		return 0;
+	}
+	run.records = malloc(len * sizeof(*run.records));
+	run.size = len;
+	struct sort_record *block = malloc(max_block * sizeof(*block));
+	if (run.records == NULL || block == NULL) {
+		printf("Failed to allocate %zu records for sorting.\n", len + max_block);
+		free(run.records);
+		free(block);
+		return 1;
+	}
+
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(c, prev[c]);
+	}
+
+	printf("Sorting blocks of at least %.1fM steps, keeping up to %.1fM "
+			"(%.2f MB with the largest block).\n",
+			(double) SORT_BLOCK_MIN / 1000000, (double) len / 1000000,
+			(double) (len + max_block) * sizeof(*block) / 1024 / 1024);
+
+	while (!found) {
+		size_t block_len = next_block_len(run.len, max_records, chains);
+
+		if (block_len == 0) {
+			printf("Record capacity exceeded, exiting.\n");
+			break;
+		}
+
+		sort_fill_block(block, block_len, chains, prev, &steps);
+
+		if (sort_records(block, run.records + run.len, block_len, key_bits) ||
+				sort_merge(&run, block, block_len, &candidates)) {
+			printf("Failed to allocate memory for sorting.\n");
+			ret = 1;
+			break;
+		}
+
+		found = sort_resolve_candidates(&candidates, chains);
+	}
+
+	printf("Sorted records using %.2f MB.\n",
+			(double) run.len * sizeof(*run.records) / 1024 / 1024);
+	free(block);
+	free(run.records);
+	free(candidates.pairs);
+
+	return ret;
+}
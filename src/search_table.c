@@ -0,0 +1,173 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include "chain.h"
+#include "search.h"
+#include "table.h"
+
+// Exact in-memory search: every trimmed hash goes into a bit-packed hash
+// table along with its step number, so a hit is always a real collision
+// and there's no second-level storage to consult. The preimages aren't
+// stored at all, the one belonging to an earlier step is found again by
+// replaying its chain from the seed.
+//
+// With --filter-file the table lives in a file, together with where the
+// chains stand after the last whole round, so the next run picks the
+// search up from there.
+
+// where the search stands, kept in the table's file
+struct table_position {
+	unsigned long long steps;
+	unsigned int bitlen;
+	unsigned int chains;
+	unsigned char prev[MAX_CHAINS][sizeof(uint64_t)];
+};
+
+static volatile sig_atomic_t interrupted;
+
+
+static void on_signal(int sig) {
+	interrupted = 1;
+}
+
+int search_table(const struct search_options *opts) {
+	unsigned int chains = opts->chains;
+	unsigned char prev[MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+	uint64_t keys[MAX_CHAINS];
+	unsigned long elems = opts->elems;
+	unsigned int step_bits = 1;
+	unsigned int max_bits;
+
+	for (unsigned int c = 0; c < chains; c++) {
+		chain_seed(c, prev[c]);
+	}
+
+	while ((elems >> step_bits) > 0) {
+		step_bits++;
+	}
+
+	// a slot takes about bitlen + 8 bits whatever the number of elems,
+	// the bits the slot number saves go to the step number
+	max_bits = table_max_key_bits(elems, step_bits);
+	if (bitlen > max_bits) {
+		printf("Hash table mode fits prefixes of up to %u bits into its "
+				"64-bit slots (at %.1fM elems).\n", max_bits,
+				(double) elems / 1000000);
+		return 1;
+	}
+
+	struct table table;
+	printf("Setting up hash table for up to %.1fM elems.\n",
+			(double) elems / 1000000);
+	if (table_init(&table, elems, bitlen, step_bits, opts->filter_file)) {
+		printf("Failed to init hash table! Tried to allocate %.2f MB.\n",
+				(double) table.bytes / 1024 / 1024);
+		return 1;
+	}
+	printf("Hash table using %.2f MB (%u bits per slot, %zu slots).\n",
+			(double) table.bytes / 1024 / 1024, table.slot_bits, table.slots);
+
+	unsigned long long steps = 1;
+	struct table_position *pos = table.user;
+	if (pos != NULL && table.attached && pos->steps > 0) {
+		if (pos->bitlen != bitlen || pos->chains != chains) {
+			printf("%s holds a %u-bit search walking %u chain(s).\n",
+					opts->filter_file, pos->bitlen, pos->chains);
+			table_free(&table);
+			return 1;
+		}
+		steps = pos->steps;
+		for (unsigned int c = 0; c < chains; c++) {
+			memcpy(prev[c], pos->prev[c], hashlen);
+		}
+		printf("Continuing after %llu iterations from %s.\n", steps - 1,
+				opts->filter_file);
+	}
+
+	// stopping in between rounds keeps the table and position in step
+	if (pos != NULL) {
+		struct sigaction sa = { .sa_handler = on_signal };
+
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+	}
+
+	int found = 0;
+	while (!found && !interrupted) {
+		sha256_short_many(prev, SHA256_HASH_SIZE, bitlen, chains, hash[0]);
+
+		// start loading all chains' home slots before the first insert,
+		// so their cache misses overlap
+		for (unsigned int c = 0; c < chains; c++) {
+			trim_hash(hash[c]);
+			keys[c] = hash_key(hash[c]);
+			table_prefetch(&table, keys[c]);
+		}
+
+		for (unsigned int c = 0; c < chains; c++) {
+			size_t len = hashlen;
+			uint64_t old;
+			int ret = table_insert(&table, keys[c], steps, &old);
+
+			if (ret > 0) {
+				unsigned char other[SHA256_HASH_SIZE];
+
+				chain_replay(old, chains, other);
+				// same preimage, ie. this chain ran into a value
+				// another chain started from; not a collision
+				if (memcmp(other, prev[c], len) != 0) {
+					printf("Found %u-bit collision after %llu iterations :: ",
+							bitlen, steps);
+					print_hex(hash[c], len);
+					printf("\n");
+					printf("Data with the same hash:\n");
+					printf("\t");
+					print_hex(other, len);
+					printf(" (chain %u)\n\t", (unsigned int) ((old - 1) % chains));
+					print_hex(prev[c], len);
+					printf(" (chain %u)\n", c);
+					found = 1;
+					break;
+				}
+			} else if (ret == -1) {
+				printf("Hash table capacity exceeded, exiting.\n");
+				found = 1;
+				break;
+			} else if (ret < 0) {
+				// bad luck rather than a full table: only the biggest
+				// tables near TABLE_MAX_LOAD get clusters that long
+				printf("Hash table cluster longer than %u slots at %.1f%% "
+						"load, exiting; a larger -n spreads the steps over "
+						"more slots.\n", TABLE_MAX_DISP,
+						100.0 * table.used / table.slots);
+				found = 1;
+				break;
+			}
+
+			// current -> prev
+			memcpy(prev[c], hash[c], len);
+			steps++;
+		}
+
+		// a run stopped in the middle of a round redoes it, the steps
+		// already inserted are found with their own step numbers then
+		if (pos != NULL && !found) {
+			pos->steps = steps;
+			pos->bitlen = bitlen;
+			pos->chains = chains;
+			for (unsigned int c = 0; c < chains; c++) {
+				memcpy(pos->prev[c], prev[c], hashlen);
+			}
+		}
+	}
+
+	if (interrupted && !found) {
+		printf("Interrupted after %llu iterations, run again with the same "
+				"--filter-file to continue.\n", steps - 1);
+	}
+	table_free(&table);
+
+	return 0;
+}
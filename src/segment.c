@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "segment.h"
+
+#define SEGMENT_BUF_RECORDS (SEGMENT_IO_BYTES / sizeof(struct sort_record))
+
+
+static int write_all(int fd, const void *buf, size_t bytes) {
+	const char *p = buf;
+
+	while (bytes > 0) {
+		ssize_t n = write(fd, p, bytes);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return 1;
+		}
+		p += n;
+		bytes -= n;
+	}
+
+	return 0;
+}
+
+static ssize_t read_full(int fd, void *buf, size_t bytes) {
+	// a short read only at the end of the file
+	char *p = buf;
+	size_t got = 0;
+
+	while (got < bytes) {
+		ssize_t n = read(fd, p + got, bytes - got);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			return -1;
+		} else if (n == 0) {
+			break;
+		}
+		got += n;
+	}
+
+	return got;
+}
+
+
+int segment_create(struct segment_writer *w, const char *path) {
+	w->len = 0;
+	w->records = 0;
+	w->buf = aligned_alloc(SEGMENT_ALIGN, SEGMENT_IO_BYTES);
+	if (w->buf == NULL) {
+		return 1;
+	}
+
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		free(w->buf);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int segment_flush(struct segment_writer *w) {
+	if (w->len > 0 && write_all(w->fd, w->buf, w->len * sizeof(*w->buf))) {
+		return 1;
+	}
+	w->len = 0;
+
+	return 0;
+}
+
+int segment_append(struct segment_writer *w, const struct sort_record *r,
+		size_t n) {
+	while (n > 0) {
+		size_t room = SEGMENT_BUF_RECORDS - w->len;
+		size_t take = n < room ? n : room;
+
+		memcpy(w->buf + w->len, r, take * sizeof(*r));
+		w->len += take;
+		w->records += take;
+		r += take;
+		n -= take;
+
+		if (w->len == SEGMENT_BUF_RECORDS && segment_flush(w)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int segment_finish(struct segment_writer *w) {
+	int ret = segment_flush(w);
+
+	free(w->buf);
+	return close(w->fd) || ret;
+}
+
+int segment_open(struct segment_reader *r, const char *path) {
+	r->pos = 0;
+	r->len = 0;
+	r->buf = aligned_alloc(SEGMENT_ALIGN, SEGMENT_IO_BYTES);
+	if (r->buf == NULL) {
+		return 1;
+	}
+
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) {
+		free(r->buf);
+		return 1;
+	}
+	// read once front to back, let the kernel read ahead further
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return 0;
+}
+
+int segment_next(struct segment_reader *r, const struct sort_record **rec) {
+	if (r->pos == r->len) {
+		ssize_t got = read_full(r->fd, r->buf, SEGMENT_IO_BYTES);
+
+		if (got < 0 || got % sizeof(*r->buf)) {
+			return 1;
+		}
+		r->pos = 0;
+		r->len = got / sizeof(*r->buf);
+		if (r->len == 0) {
+			*rec = NULL;
+			return 0;
+		}
+	}
+
+	*rec = &r->buf[r->pos++];
+	return 0;
+}
+
+void segment_close(struct segment_reader *r) {
+	close(r->fd);
+	free(r->buf);
+}
+
+
+struct merge_source {
+	struct segment_reader reader;
+	const struct sort_record *rec;
+};
+
+static int source_before(const struct merge_source *s, size_t a, size_t b) {
+	// by key, ties go to the earlier input which has the earlier steps
+	return s[a].rec->key < s[b].rec->key ||
+			(s[a].rec->key == s[b].rec->key && a < b);
+}
+
+static void heap_down(const struct merge_source *s, size_t *heap, size_t len,
+		size_t i) {
+	for (;;) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < len && source_before(s, heap[l], heap[min])) {
+			min = l;
+		}
+		if (r < len && source_before(s, heap[r], heap[min])) {
+			min = r;
+		}
+		if (min == i) {
+			return;
+		}
+
+		size_t tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+int segment_merge(const char *const *inputs, size_t n, size_t first_new,
+		const char *out, struct sort_pairs *candidates, size_t *records) {
+	// k-way merge through a binary heap of the inputs' next records
+	struct merge_source *src = calloc(n, sizeof(*src));
+	size_t *heap = calloc(n, sizeof(*heap));
+	struct segment_writer w;
+	struct sort_record last = { 0 };
+	size_t opened = 0, len = 0;
+	int ret = 1;
+
+	if (src == NULL || heap == NULL || segment_create(&w, out)) {
+		free(src);
+		free(heap);
+		return 1;
+	}
+
+	for (; opened < n; opened++) {
+		if (segment_open(&src[opened].reader, inputs[opened])) {
+			goto out;
+		}
+		if (segment_next(&src[opened].reader, &src[opened].rec)) {
+			opened++;
+			goto out;
+		}
+		if (src[opened].rec != NULL) {
+			heap[len++] = opened;
+		}
+	}
+	for (size_t i = len / 2; i > 0; i--) {
+		heap_down(src, heap, len, i - 1);
+	}
+
+	while (len > 0) {
+		size_t i = heap[0];
+		const struct sort_record *rec = src[i].rec;
+
+		if (i >= first_new && w.records > 0 && rec->key == last.key &&
+				sort_pairs_add(candidates, last.step, rec->step)) {
+			goto out;
+		}
+		last = *rec;
+		if (segment_append(&w, rec, 1) || segment_next(&src[i].reader, &src[i].rec)) {
+			goto out;
+		}
+
+		if (src[i].rec == NULL) {
+			heap[0] = heap[--len];
+		}
+		heap_down(src, heap, len, 0);
+	}
+	ret = 0;
+
+out:
+	for (size_t i = 0; i < opened; i++) {
+		segment_close(&src[i].reader);
+	}
+	free(src);
+	free(heap);
+	*records = w.records;
+
+	return segment_finish(&w) || ret;
+}
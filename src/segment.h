@@ -0,0 +1,49 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stddef.h>
+#include "sort.h"
+
+// Segment files of sorted (key, step number) records for the external
+// sort search: raw records, written and read strictly sequentially in
+// large aligned chunks so the disk can stream them.
+
+// bytes per read() or write() and the alignment of the buffers
+#define SEGMENT_IO_BYTES (4 << 20)
+#define SEGMENT_ALIGN 4096
+
+struct segment_writer {
+	int fd;
+	struct sort_record *buf;
+	size_t len;
+	size_t records;
+};
+
+struct segment_reader {
+	int fd;
+	struct sort_record *buf;
+	size_t pos;
+	size_t len;
+};
+
+// all of these return 0 on success and 1 on errors (with errno set)
+
+int segment_create(struct segment_writer *w, const char *path);
+int segment_append(struct segment_writer *w, const struct sort_record *r,
+		size_t n);
+// flushes and closes the file
+int segment_finish(struct segment_writer *w);
+
+int segment_open(struct segment_reader *r, const char *path);
+// points rec at the next record, or at NULL once there are no more
+int segment_next(struct segment_reader *r, const struct sort_record **rec);
+void segment_close(struct segment_reader *r);
+
+// merges n segments into a new one at out; the inputs must be given in
+// step order (all steps of one before those of the next) so that equal
+// keys come out in step order too; every record from input first_new
+// on with the same key as the one before it is added to candidates
+int segment_merge(const char *const *inputs, size_t n, size_t first_new,
+		const char *out, struct sort_pairs *candidates, size_t *records);
+
+#endif //SEGMENT_H
@@ -49,6 +49,7 @@
 #define NEED_U64_LOW
 
 #include "sha256.h"
+#include "sha256_x86.h"
 
 /* Circular right rotation of 32-bit value 'val' left by 'bits' bits
    (assumes that 'bits' is always within range from 0 to 32) */
@@ -74,78 +75,126 @@ static const sha_u32 H[ ] = { 0x6a09e667,
                               0x1f83d9ab,
                               0x5be0cd19 };
 
-/* Constants required for hash calculation (see p. 11 of FIPS 180-3) */
-
-static const sha_u32 K[ ] = { 0x428a2f98,
-                              0x71374491,
-                              0xb5c0fbcf,
-                              0xe9b5dba5,
-                              0x3956c25b,
-                              0x59f111f1,
-                              0x923f82a4,
-                              0xab1c5ed5,
-                              0xd807aa98,
-                              0x12835b01,
-                              0x243185be,
-                              0x550c7dc3,
-                              0x72be5d74,
-                              0x80deb1fe,
-                              0x9bdc06a7,
-                              0xc19bf174,
-                              0xe49b69c1,
-                              0xefbe4786,
-                              0x0fc19dc6,
-                              0x240ca1cc,
-                              0x2de92c6f,
-                              0x4a7484aa,
-                              0x5cb0a9dc,
-                              0x76f988da,
-                              0x983e5152,
-                              0xa831c66d,
-                              0xb00327c8,
-                              0xbf597fc7,
-                              0xc6e00bf3,
-                              0xd5a79147,
-                              0x06ca6351,
-                              0x14292967,
-                              0x27b70a85,
-                              0x2e1b2138,
-                              0x4d2c6dfc,
-                              0x53380d13,
-                              0x650a7354,
-                              0x766a0abb,
-                              0x81c2c92e,
-                              0x92722c85,
-                              0xa2bfe8a1,
-                              0xa81a664b,
-                              0xc24b8b70,
-                              0xc76c51a3,
-                              0xd192e819,
-                              0xd6990624,
-                              0xf40e3585,
-                              0x106aa070,
-                              0x19a4c116,
-                              0x1e376c08,
-                              0x2748774c,
-                              0x34b0bcb5,
-                              0x391c0cb3,
-                              0x4ed8aa4a,
-                              0x5b9cca4f,
-                              0x682e6ff3,
-                              0x748f82ee,
-                              0x78a5636f,
-                              0x84c87814,
-                              0x8cc70208,
-                              0x90befffa,
-                              0xa4506ceb,
-                              0xbef9a3f7,
-                              0xc67178f2 };
+/* Constants required for hash calculation (see p. 11 of FIPS 180-3),
+   also used by the vectorized kernels in sha256_x86.c */
+
+const sha_u32 sha256_K[ 64 ] = { 0x428a2f98,
+                                 0x71374491,
+                                 0xb5c0fbcf,
+                                 0xe9b5dba5,
+                                 0x3956c25b,
+                                 0x59f111f1,
+                                 0x923f82a4,
+                                 0xab1c5ed5,
+                                 0xd807aa98,
+                                 0x12835b01,
+                                 0x243185be,
+                                 0x550c7dc3,
+                                 0x72be5d74,
+                                 0x80deb1fe,
+                                 0x9bdc06a7,
+                                 0xc19bf174,
+                                 0xe49b69c1,
+                                 0xefbe4786,
+                                 0x0fc19dc6,
+                                 0x240ca1cc,
+                                 0x2de92c6f,
+                                 0x4a7484aa,
+                                 0x5cb0a9dc,
+                                 0x76f988da,
+                                 0x983e5152,
+                                 0xa831c66d,
+                                 0xb00327c8,
+                                 0xbf597fc7,
+                                 0xc6e00bf3,
+                                 0xd5a79147,
+                                 0x06ca6351,
+                                 0x14292967,
+                                 0x27b70a85,
+                                 0x2e1b2138,
+                                 0x4d2c6dfc,
+                                 0x53380d13,
+                                 0x650a7354,
+                                 0x766a0abb,
+                                 0x81c2c92e,
+                                 0x92722c85,
+                                 0xa2bfe8a1,
+                                 0xa81a664b,
+                                 0xc24b8b70,
+                                 0xc76c51a3,
+                                 0xd192e819,
+                                 0xd6990624,
+                                 0xf40e3585,
+                                 0x106aa070,
+                                 0x19a4c116,
+                                 0x1e376c08,
+                                 0x2748774c,
+                                 0x34b0bcb5,
+                                 0x391c0cb3,
+                                 0x4ed8aa4a,
+                                 0x5b9cca4f,
+                                 0x682e6ff3,
+                                 0x748f82ee,
+                                 0x78a5636f,
+                                 0x84c87814,
+                                 0x8cc70208,
+                                 0x90befffa,
+                                 0xa4506ceb,
+                                 0xbef9a3f7,
+                                 0xc67178f2 };
 
 
 /* Local functions */
 
 static void sha256_process_block( SHA256_Context * context );
+static void sha256_compress( sha_u32 state[ 8 ],
+                             sha_u32 W[ 64 ] );
 static void sha256_evaluate( SHA256_Context * context );
+static void sha256_short_block( const unsigned char * d,
+                                size_t                num_bits,
+                                sha_u32               W[ 16 ] );
+static void sha256_store_digest( const sha_u32   state[ 8 ],
+                                 unsigned char   digest[ SHA256_HASH_SIZE ] );
+static void sha256_x1_scalar( sha_u32 state[ ][ 8 ],
+                              sha_u32 W[ ][ 16 ] );
+
+
+/* Available kernels, best first. 'compress' handles one single-block
+   message per lane for sha256_short_many(), 'single' one block for
+   the context based functions and sha256_short(). If a kernel has no
+   'single' function of its own the fastest one available is used. */
+
+#define SHA256_MAX_LANES  16
+
+typedef void ( * SHA256_Single )( sha_u32 state[ 8 ], sha_u32 W[ 64 ] );
+
+typedef struct {
+    const char    * name;
+    size_t          lanes;
+    SHA256_Single   single;
+    void         ( * compress )( sha_u32 state[ ][ 8 ], sha_u32 W[ ][ 16 ] );
+    int          ( * available )( void );
+} SHA256_Kernel;
+
+static const SHA256_Kernel kernels[ ] = {
+#if defined SHA256_HAVE_X86
+    { "avx512", 16, NULL,                  sha256_x16_avx512,
+      sha256_x86_has_avx512 },
+    { "avx2",    8, NULL,                  sha256_x8_avx2,
+      sha256_x86_has_avx2 },
+    { "shani",   2, sha256_compress_shani, sha256_x2_shani,
+      sha256_x86_has_shani },
+#endif
+    { "scalar",  1, sha256_compress,       sha256_x1_scalar,
+      NULL }
+};
+
+static const SHA256_Kernel *kernel = NULL;
+static SHA256_Single        single = NULL;
+static char                 kernel_desc[ 32 ];
+
+#define KERNEL  ( kernel ? kernel : ( sha256_select_kernel( NULL ), kernel ) )
+#define SINGLE  ( single ? single : ( sha256_select_kernel( NULL ), single ) )
 
 
 /*----------------------------------------------------------------*
@@ -358,6 +407,232 @@ sha256_calculate( SHA256_Context  * context,
 }
 
 
+/*----------------------------------------------------------------*
+ * Calculates the hash of a message of at most SHA256_SHORT_MAX_BITS
+ * bits in one go. Since such a message always fits into a single
+ * block together with its padding there's no need for a context:
+ * the padded block is assembled directly as message schedule words
+ * and compressed once.
+ *----------------------------------------------------------------*/
+
+int
+sha256_short( const void    * data,
+              size_t          num_bits,
+              unsigned char   digest[ SHA256_HASH_SIZE ] )
+{
+    sha_u32 W[ 64 ];
+    sha_u32 state[ 8 ];
+
+
+    if ( ! data || ! digest )
+        return SHA_DIGEST_INVALID_ARG;
+
+    if ( num_bits > SHA256_SHORT_MAX_BITS )
+        return SHA_DIGEST_INPUT_TOO_LONG;
+
+    sha256_short_block( data, num_bits, W );
+
+    memcpy( state, H, sizeof H );
+    SINGLE( state, W );
+    sha256_store_digest( state, digest );
+
+    return SHA_DIGEST_OK;
+}
+
+
+/*----------------------------------------------------------------*
+ * Calculates the hashes of 'count' messages of 'num_bits' bits
+ * each (at most SHA256_SHORT_MAX_BITS), the i-th message starting
+ * 'stride' bytes after the (i-1)-th one. The digests are written
+ * back to back to 'digests'. Several messages get compressed at
+ * once if a multi-buffer kernel is available.
+ *----------------------------------------------------------------*/
+
+int
+sha256_short_many( const void    * data,
+                   size_t          stride,
+                   size_t          num_bits,
+                   size_t          count,
+                   unsigned char * digests )
+{
+    const unsigned char *d = data;
+    sha_u32              W[ SHA256_MAX_LANES ][ 16 ];
+    sha_u32              state[ SHA256_MAX_LANES ][ 8 ];
+    size_t               i,
+                         n;
+
+
+    if ( ! data || ! digests )
+        return SHA_DIGEST_INVALID_ARG;
+
+    if ( num_bits > SHA256_SHORT_MAX_BITS )
+        return SHA_DIGEST_INPUT_TOO_LONG;
+
+    while ( count )
+    {
+        n = count < KERNEL->lanes ? count : kernel->lanes;
+
+        /* A few leftover messages are cheaper to hash one by one than
+           with a mostly empty vector */
+
+        if ( n == 1 || n * 4 <= kernel->lanes )
+        {
+            for ( i = 0; i < n; i++ )
+                sha256_short( d + i * stride, num_bits,
+                              digests + i * SHA256_HASH_SIZE );
+        }
+        else
+        {
+            /* Unused lanes of the last round just repeat the last
+               message */
+
+            for ( i = 0; i < kernel->lanes; i++ )
+            {
+                sha256_short_block( d + ( i < n ? i : n - 1 ) * stride,
+                                    num_bits, W[ i ] );
+                memcpy( state[ i ], H, sizeof H );
+            }
+
+            kernel->compress( state, W );
+
+            for ( i = 0; i < n; i++ )
+                sha256_store_digest( state[ i ],
+                                     digests + i * SHA256_HASH_SIZE );
+        }
+
+        d       += n * stride;
+        digests += n * SHA256_HASH_SIZE;
+        count   -= n;
+    }
+
+    return SHA_DIGEST_OK;
+}
+
+
+/*----------------------------------------------------------------*
+ * Selects the kernel used for all hash calculations by name, or the
+ * fastest one supported by the CPU if 'name' is NULL. Meant to be
+ * called once at startup, before any threads get started.
+ *----------------------------------------------------------------*/
+
+int
+sha256_select_kernel( const char * name )
+{
+    size_t i;
+
+
+    for ( i = 0; i < sizeof kernels / sizeof *kernels; i++ )
+    {
+        if ( name && strcmp( name, kernels[ i ].name ) )
+            continue;
+
+        if ( kernels[ i ].available && ! kernels[ i ].available( ) )
+        {
+            if ( name )
+                return SHA_DIGEST_INVALID_ARG;
+            continue;
+        }
+
+        kernel = kernels + i;
+
+        single = kernel->single ? kernel->single : sha256_compress;
+#if defined SHA256_HAVE_X86
+        if ( ! kernel->single && sha256_x86_has_shani( ) )
+            single = sha256_compress_shani;
+#endif
+
+        strcpy( kernel_desc, kernel->name );
+        if ( single != kernel->single && single != sha256_compress )
+            strcat( kernel_desc, "+shani" );
+
+        return SHA_DIGEST_OK;
+    }
+
+    return SHA_DIGEST_INVALID_ARG;
+}
+
+
+/*----------------------------------------------------------------*
+ * Returns the name of the kernel in use (with "+shani" appended if
+ * single blocks get compressed with the SHA extensions)
+ *----------------------------------------------------------------*/
+
+const char *
+sha256_kernel_name( void )
+{
+    return KERNEL ? kernel_desc : NULL;
+}
+
+
+/*----------------------------------------------------------------*
+ * Sets up the message schedule words of the single padded block
+ * for a message of at most SHA256_SHORT_MAX_BITS bits
+ *----------------------------------------------------------------*/
+
+static void
+sha256_short_block( const unsigned char * d,
+                    size_t                num_bits,
+                    sha_u32               W[ 16 ] )
+{
+    size_t num_bytes = ( num_bits + 7 ) / 8;
+    size_t i;
+
+
+    for ( i = 0; i < 16; i++ )
+        W[ i ] = 0;
+
+    for ( i = 0; i < num_bytes; i++ )
+        W[ i / 4 ] |= SHA_T8L( d[ i ] ) << ( 24 - 8 * ( i % 4 ) );
+
+    /* Drop the unused low bits of the last byte, append the single set
+       padding bit and store the bit count (always below 2^32 here) */
+
+    if ( num_bits % 32 )
+        W[ num_bits / 32 ] &= SHA_T32( ~ ( 0xFFFFFFFFUL >> ( num_bits % 32 ) ) );
+    W[ num_bits / 32 ] |= 0x80000000UL >> ( num_bits % 32 );
+    W[ 15 ] = num_bits;
+}
+
+
+/*----------------------------------------------------------------*
+ * Converts the state words into the (big-endian) digest
+ *----------------------------------------------------------------*/
+
+static void
+sha256_store_digest( const sha_u32   state[ 8 ],
+                     unsigned char   digest[ SHA256_HASH_SIZE ] )
+{
+    size_t i,
+           j;
+
+
+    for ( i = j = 0; j < SHA256_HASH_SIZE; i++ )
+    {
+        digest[ j++ ] = state[ i ] >> 24;
+        digest[ j++ ] = state[ i ] >> 16;
+        digest[ j++ ] = state[ i ] >>  8;
+        digest[ j++ ] = state[ i ];
+    }
+}
+
+
+/*----------------------------------------------------------------*
+ * Single lane "multi-buffer" kernel, used when there's nothing
+ * better available
+ *----------------------------------------------------------------*/
+
+static void
+sha256_x1_scalar( sha_u32 state[ ][ 8 ],
+                  sha_u32 W[ ][ 16 ] )
+{
+    sha_u32 Wx[ 64 ];
+
+
+    memcpy( Wx, W[ 0 ], sizeof W[ 0 ] );
+    sha256_compress( state[ 0 ], Wx );
+}
+
+
 /*----------------------------------------------------------------*
  * Central routine for calculating the hash value. See the FIPS
  * 180-3 standard p. 21f for a detailed explanation.
@@ -380,27 +655,48 @@ sha256_process_block( SHA256_Context * context )
 {
     size_t         t;
     sha_u32        W[ 64 ];
-    sha_u32        A, B, C, D, E, F, G, H, tmp;
     unsigned char *buf = context->buf;
 
 
-    A = context->H[ 0 ];
-    B = context->H[ 1 ];
-    C = context->H[ 2 ];
-    D = context->H[ 3 ];
-    E = context->H[ 4 ];
-    F = context->H[ 5 ];
-    G = context->H[ 6 ];
-    H = context->H[ 7 ];
-
     for ( t = 0; t < 16; t++ )
     {
 		W[ t ]  = SHA_T8L( *buf++ ) << 24;
 		W[ t ] |= SHA_T8L( *buf++ ) << 16;
 		W[ t ] |= SHA_T8L( *buf++ ) <<  8;
 		W[ t ] |= SHA_T8L( *buf++ );
+    }
+
+    SINGLE( context->H, W );
 
-        tmp = SHA_T32( H + Sig1 + Ch + K[ t ] + W[ t ] );
+    context->index = 0;
+}
+
+
+/*----------------------------------------------------------------*
+ * Runs the 64 rounds over a message schedule whose first 16 words
+ * have already been filled in and adds the result to the state.
+ *----------------------------------------------------------------*/
+
+static void
+sha256_compress( sha_u32 state[ 8 ],
+                 sha_u32 W[ 64 ] )
+{
+    size_t         t;
+    sha_u32        A, B, C, D, E, F, G, H, tmp;
+
+
+    A = state[ 0 ];
+    B = state[ 1 ];
+    C = state[ 2 ];
+    D = state[ 3 ];
+    E = state[ 4 ];
+    F = state[ 5 ];
+    G = state[ 6 ];
+    H = state[ 7 ];
+
+    for ( t = 0; t < 16; t++ )
+    {
+        tmp = SHA_T32( H + Sig1 + Ch + sha256_K[ t ] + W[ t ] );
         H = G;
         G = F;
         F = E;
@@ -416,7 +712,7 @@ sha256_process_block( SHA256_Context * context )
 		W[ t ] = SHA_T32(   sig1( W[ t -  2 ] ) + W[ t -  7 ]
                           + sig0( W[ t - 15 ] ) + W[ t - 16 ] );
 
-        tmp = SHA_T32( H + Sig1 + Ch + K[ t ] + W[ t ] );
+        tmp = SHA_T32( H + Sig1 + Ch + sha256_K[ t ] + W[ t ] );
         H = G;
         G = F;
         F = E;
@@ -427,16 +723,14 @@ sha256_process_block( SHA256_Context * context )
         A = SHA_T32( tmp + Sig0 + Maj );
     }
 
-    context->H[ 0 ] = SHA_T32( context->H[ 0 ] + A );
-    context->H[ 1 ] = SHA_T32( context->H[ 1 ] + B );
-    context->H[ 2 ] = SHA_T32( context->H[ 2 ] + C );
-    context->H[ 3 ] = SHA_T32( context->H[ 3 ] + D );
-    context->H[ 4 ] = SHA_T32( context->H[ 4 ] + E );
-    context->H[ 5 ] = SHA_T32( context->H[ 5 ] + F );
-    context->H[ 6 ] = SHA_T32( context->H[ 6 ] + G );
-    context->H[ 7 ] = SHA_T32( context->H[ 7 ] + H );
-
-    context->index = 0;
+    state[ 0 ] = SHA_T32( state[ 0 ] + A );
+    state[ 1 ] = SHA_T32( state[ 1 ] + B );
+    state[ 2 ] = SHA_T32( state[ 2 ] + C );
+    state[ 3 ] = SHA_T32( state[ 3 ] + D );
+    state[ 4 ] = SHA_T32( state[ 4 ] + E );
+    state[ 5 ] = SHA_T32( state[ 5 ] + F );
+    state[ 6 ] = SHA_T32( state[ 6 ] + G );
+    state[ 7 ] = SHA_T32( state[ 7 ] + H );
 }
 
 
@@ -51,6 +51,10 @@
 
 #define SHA256_HASH_SIZE        32
 
+/* Longest message (in bits) that still fits into a single block */
+
+#define SHA256_SHORT_MAX_BITS   447
+
 
 #if ! defined SHA_DIGEST_OK
 #define SHA_DIGEST_OK               0
@@ -88,6 +92,16 @@ int sha256_add_bits( SHA256_Context * context,
                      size_t           num_bits );
 int sha256_calculate( SHA256_Context * context,
                       unsigned char    digest[ SHA256_HASH_SIZE ] );
+int sha256_short( const void    * data,
+                  size_t          num_bits,
+                  unsigned char   digest[ SHA256_HASH_SIZE ] );
+int sha256_short_many( const void    * data,
+                       size_t          stride,
+                       size_t          num_bits,
+                       size_t          count,
+                       unsigned char * digests );
+int sha256_select_kernel( const char * name );
+const char * sha256_kernel_name( void );
 
 #endif /* ! SHA256_HASH_HEADER_ */
 
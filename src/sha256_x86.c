@@ -0,0 +1,405 @@
+/*
+ *  Vectorized SHA256 compression kernels for x86 CPUs.
+ *
+ *  The multi-buffer kernels don't speed up a single hash at all,
+ *  instead they transpose several independent messages so that each
+ *  32-bit lane of a vector register works on a different message.
+ *  This gives 8 hashes per compression with AVX2 and 16 with AVX-512.
+ *
+ *  The SHA extensions (SHA-NI) on the other hand implement the rounds
+ *  and the message schedule directly, two rounds per sha256rnds2. The
+ *  setup of the state registers follows the well-known example code
+ *  by Intel, as e.g. found in the Linux kernel.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include "sha256_x86.h"
+
+#if defined SHA256_HAVE_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+
+/*----------------------------------------------------------------*
+ * CPU feature tests (these also check that the OS saves the wider
+ * registers on context switches)
+ *----------------------------------------------------------------*/
+
+int
+sha256_x86_has_avx2( void )
+{
+    __builtin_cpu_init( );
+    return __builtin_cpu_supports( "avx2" );
+}
+
+
+int
+sha256_x86_has_avx512( void )
+{
+    __builtin_cpu_init( );
+    return __builtin_cpu_supports( "avx512f" );
+}
+
+
+int
+sha256_x86_has_shani( void )
+{
+    unsigned int a, b, c, d;
+
+
+    /* SSE4.1 in CPUID leaf 1 ECX bit 19, SHA in leaf 7 EBX bit 29 */
+
+    if ( ! __get_cpuid( 1, &a, &b, &c, &d ) || ! ( c & ( 1U << 19 ) ) )
+        return 0;
+
+    if ( ! __get_cpuid_count( 7, 0, &a, &b, &c, &d ) )
+        return 0;
+
+    return ( b & ( 1U << 29 ) ) != 0;
+}
+
+
+/*----------------------------------------------------------------*
+ * SHA-NI compression of 'n' independent blocks. With n > 1 the
+ * instructions of the different blocks are interleaved, so while one
+ * sha256rnds2 waits for its predecessor the others can proceed. It is
+ * always inlined with a constant 'n' so the loops over the blocks
+ * get unrolled and everything stays in registers.
+ *----------------------------------------------------------------*/
+
+#define SHANI_MAX_LANES  2
+
+__attribute__(( target( "sha,sse4.1" ), always_inline ))
+static inline void
+sha256_shani_lanes( sha_u32 state[ ][ 8 ],
+                    sha_u32 W[ ][ 16 ],
+                    int     n )
+{
+    __m128i S0[ SHANI_MAX_LANES ],
+            S1[ SHANI_MAX_LANES ],
+            save0[ SHANI_MAX_LANES ],
+            save1[ SHANI_MAX_LANES ],
+            M[ SHANI_MAX_LANES ][ 4 ];
+    __m128i tmp,
+            msg;
+    int     i,
+            l;
+
+
+    for ( l = 0; l < n; l++ )
+    {
+        /* Rearrange A...H into the ABEF and CDGH order used by the
+           instructions. The message words are already in host order. */
+
+        tmp     = _mm_shuffle_epi32( _mm_loadu_si128(
+                                   ( const __m128i * ) &state[ l ][ 0 ] ), 0xB1 );
+        S1[ l ] = _mm_shuffle_epi32( _mm_loadu_si128(
+                                   ( const __m128i * ) &state[ l ][ 4 ] ), 0x1B );
+        S0[ l ] = _mm_alignr_epi8( tmp, S1[ l ], 8 );
+        S1[ l ] = _mm_blend_epi16( S1[ l ], tmp, 0xF0 );
+
+        save0[ l ] = S0[ l ];
+        save1[ l ] = S1[ l ];
+
+        for ( i = 0; i < 4; i++ )
+            M[ l ][ i ] = _mm_loadu_si128( ( const __m128i * ) &W[ l ][ 4 * i ] );
+    }
+
+    /* 16 groups of 4 rounds, computing the message words needed for
+       the group 4 ahead at the same time */
+
+    for ( i = 0; i < 16; i++ )
+    {
+        for ( l = 0; l < n; l++ )
+        {
+            msg = _mm_add_epi32( M[ l ][ i & 3 ], _mm_loadu_si128(
+                                ( const __m128i * ) &sha256_K[ 4 * i ] ) );
+            S1[ l ] = _mm_sha256rnds2_epu32( S1[ l ], S0[ l ], msg );
+            S0[ l ] = _mm_sha256rnds2_epu32( S0[ l ], S1[ l ],
+                                             _mm_shuffle_epi32( msg, 0x0E ) );
+
+            if ( i < 12 )
+            {
+                tmp = _mm_sha256msg1_epu32( M[ l ][ i & 3 ],
+                                            M[ l ][ ( i + 1 ) & 3 ] );
+                tmp = _mm_add_epi32( tmp,
+                                     _mm_alignr_epi8( M[ l ][ ( i + 3 ) & 3 ],
+                                                      M[ l ][ ( i + 2 ) & 3 ],
+                                                      4 ) );
+                M[ l ][ i & 3 ] = _mm_sha256msg2_epu32( tmp,
+                                                        M[ l ][ ( i + 3 ) & 3 ] );
+            }
+        }
+    }
+
+    for ( l = 0; l < n; l++ )
+    {
+        S0[ l ] = _mm_add_epi32( S0[ l ], save0[ l ] );
+        S1[ l ] = _mm_add_epi32( S1[ l ], save1[ l ] );
+
+        /* Back from ABEF/CDGH to A...H */
+
+        tmp     = _mm_shuffle_epi32( S0[ l ], 0x1B );
+        S1[ l ] = _mm_shuffle_epi32( S1[ l ], 0xB1 );
+        _mm_storeu_si128( ( __m128i * ) &state[ l ][ 0 ],
+                          _mm_blend_epi16( tmp, S1[ l ], 0xF0 ) );
+        _mm_storeu_si128( ( __m128i * ) &state[ l ][ 4 ],
+                          _mm_alignr_epi8( S1[ l ], tmp, 8 ) );
+    }
+}
+
+
+/*----------------------------------------------------------------*
+ * Single block SHA-NI compression, a drop-in replacement for the
+ * portable round function (only the first 16 words of W are used)
+ *----------------------------------------------------------------*/
+
+__attribute__(( target( "sha,sse4.1" ) ))
+void
+sha256_compress_shani( sha_u32 state[ 8 ],
+                       sha_u32 W[ 64 ] )
+{
+    sha256_shani_lanes( ( sha_u32 ( * )[ 8 ] ) state,
+                        ( sha_u32 ( * )[ 16 ] ) W, 1 );
+}
+
+
+/*----------------------------------------------------------------*
+ * Two interleaved SHA-NI compressions for sha256_short_many()
+ *----------------------------------------------------------------*/
+
+__attribute__(( target( "sha,sse4.1" ) ))
+void
+sha256_x2_shani( sha_u32 state[ ][ 8 ],
+                 sha_u32 W[ ][ 16 ] )
+{
+    sha256_shani_lanes( state, W, 2 );
+}
+
+
+/*----------------------------------------------------------------*
+ * AVX2 kernel, 8 messages at once. Macros instead of inline
+ * functions since vector arguments to functions not compiled for
+ * AVX would change the ABI.
+ *----------------------------------------------------------------*/
+
+#define ROTR8( x, n ) \
+        _mm256_or_si256( _mm256_srli_epi32( x, n ), \
+                         _mm256_slli_epi32( x, 32 - ( n ) ) )
+
+#define XOR8( x, y, z ) \
+        _mm256_xor_si256( _mm256_xor_si256( x, y ), z )
+
+#define Ch8( e, f, g ) \
+        _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) )
+
+#define Maj8( a, b, c ) \
+        _mm256_or_si256( _mm256_and_si256( b, c ), \
+                         _mm256_and_si256( a, _mm256_or_si256( b, c ) ) )
+
+#define Sig0_8( x )  XOR8( ROTR8( x,  2 ), ROTR8( x, 13 ), ROTR8( x, 22 ) )
+#define Sig1_8( x )  XOR8( ROTR8( x,  6 ), ROTR8( x, 11 ), ROTR8( x, 25 ) )
+#define sig0_8( x )  XOR8( ROTR8( x,  7 ), ROTR8( x, 18 ), \
+                           _mm256_srli_epi32( x,  3 ) )
+#define sig1_8( x )  XOR8( ROTR8( x, 17 ), ROTR8( x, 19 ), \
+                           _mm256_srli_epi32( x, 10 ) )
+
+__attribute__(( target( "avx2" ) ))
+void
+sha256_x8_avx2( sha_u32 state[ ][ 8 ],
+                sha_u32 W[ ][ 16 ] )
+{
+    const __m256i widx = _mm256_setr_epi32( 0, 16, 32, 48, 64, 80, 96, 112 );
+    const __m256i sidx = _mm256_setr_epi32( 0, 8, 16, 24, 32, 40, 48, 56 );
+    __m256i       w[ 16 ],
+                  s[ 8 ];
+    __m256i       A, B, C, D, E, F, G, H, tmp;
+    sha_u32       out[ 8 ][ 8 ];
+    size_t        t,
+                  i;
+
+
+    /* Transpose message words and chaining values into the lanes */
+
+    for ( t = 0; t < 16; t++ )
+        w[ t ] = _mm256_i32gather_epi32( ( const int * ) &W[ 0 ][ t ],
+                                         widx, 4 );
+    for ( i = 0; i < 8; i++ )
+        s[ i ] = _mm256_i32gather_epi32( ( const int * ) &state[ 0 ][ i ],
+                                         sidx, 4 );
+
+    A = s[ 0 ];
+    B = s[ 1 ];
+    C = s[ 2 ];
+    D = s[ 3 ];
+    E = s[ 4 ];
+    F = s[ 5 ];
+    G = s[ 6 ];
+    H = s[ 7 ];
+
+    for ( t = 0; t < 64; t++ )
+    {
+        /* The message schedule only ever needs the last 16 words */
+
+        if ( t >= 16 )
+            w[ t & 15 ] = _mm256_add_epi32(
+                            _mm256_add_epi32( sig1_8( w[ ( t - 2 ) & 15 ] ),
+                                              w[ ( t - 7 ) & 15 ] ),
+                            _mm256_add_epi32( sig0_8( w[ ( t - 15 ) & 15 ] ),
+                                              w[ t & 15 ] ) );
+
+        tmp = _mm256_add_epi32(
+                  _mm256_add_epi32( H, Sig1_8( E ) ),
+                  _mm256_add_epi32( Ch8( E, F, G ),
+                                    _mm256_add_epi32(
+                                      _mm256_set1_epi32( sha256_K[ t ] ),
+                                      w[ t & 15 ] ) ) );
+        H = G;
+        G = F;
+        F = E;
+        E = _mm256_add_epi32( D, tmp );
+        D = C;
+        C = B;
+        B = A;
+        A = _mm256_add_epi32( tmp, _mm256_add_epi32( Sig0_8( B ),
+                                                     Maj8( B, C, D ) ) );
+    }
+
+    _mm256_storeu_si256( ( __m256i * ) out[ 0 ], _mm256_add_epi32( s[ 0 ], A ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 1 ], _mm256_add_epi32( s[ 1 ], B ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 2 ], _mm256_add_epi32( s[ 2 ], C ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 3 ], _mm256_add_epi32( s[ 3 ], D ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 4 ], _mm256_add_epi32( s[ 4 ], E ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 5 ], _mm256_add_epi32( s[ 5 ], F ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 6 ], _mm256_add_epi32( s[ 6 ], G ) );
+    _mm256_storeu_si256( ( __m256i * ) out[ 7 ], _mm256_add_epi32( s[ 7 ], H ) );
+
+    for ( i = 0; i < 8; i++ )
+        for ( t = 0; t < 8; t++ )
+            state[ t ][ i ] = out[ i ][ t ];
+}
+
+
+/*----------------------------------------------------------------*
+ * AVX-512 kernel, 16 messages at once. AVX-512 has real rotations
+ * and three-input logic which saves most of the work of Ch, Maj
+ * and the sigma functions.
+ *----------------------------------------------------------------*/
+
+#define XOR16( x, y, z )  _mm512_ternarylogic_epi32( x, y, z, 0x96 )
+#define Ch16( e, f, g )   _mm512_ternarylogic_epi32( e, f, g, 0xCA )
+#define Maj16( a, b, c )  _mm512_ternarylogic_epi32( a, b, c, 0xE8 )
+
+#define Sig0_16( x )  XOR16( _mm512_ror_epi32( x,  2 ), \
+                             _mm512_ror_epi32( x, 13 ), \
+                             _mm512_ror_epi32( x, 22 ) )
+#define Sig1_16( x )  XOR16( _mm512_ror_epi32( x,  6 ), \
+                             _mm512_ror_epi32( x, 11 ), \
+                             _mm512_ror_epi32( x, 25 ) )
+#define sig0_16( x )  XOR16( _mm512_ror_epi32( x,  7 ), \
+                             _mm512_ror_epi32( x, 18 ), \
+                             _mm512_srli_epi32( x,  3 ) )
+#define sig1_16( x )  XOR16( _mm512_ror_epi32( x, 17 ), \
+                             _mm512_ror_epi32( x, 19 ), \
+                             _mm512_srli_epi32( x, 10 ) )
+
+__attribute__(( target( "avx512f" ) ))
+void
+sha256_x16_avx512( sha_u32 state[ ][ 8 ],
+                   sha_u32 W[ ][ 16 ] )
+{
+    const __m512i widx = _mm512_setr_epi32(   0,  16,  32,  48,
+                                             64,  80,  96, 112,
+                                            128, 144, 160, 176,
+                                            192, 208, 224, 240 );
+    const __m512i sidx = _mm512_setr_epi32(   0,   8,  16,  24,
+                                             32,  40,  48,  56,
+                                             64,  72,  80,  88,
+                                             96, 104, 112, 120 );
+    __m512i       w[ 16 ],
+                  s[ 8 ];
+    __m512i       A, B, C, D, E, F, G, H, tmp;
+    sha_u32       out[ 8 ][ 16 ];
+    size_t        t,
+                  i;
+
+
+    for ( t = 0; t < 16; t++ )
+        w[ t ] = _mm512_i32gather_epi32( widx, &W[ 0 ][ t ], 4 );
+    for ( i = 0; i < 8; i++ )
+        s[ i ] = _mm512_i32gather_epi32( sidx, &state[ 0 ][ i ], 4 );
+
+    A = s[ 0 ];
+    B = s[ 1 ];
+    C = s[ 2 ];
+    D = s[ 3 ];
+    E = s[ 4 ];
+    F = s[ 5 ];
+    G = s[ 6 ];
+    H = s[ 7 ];
+
+    for ( t = 0; t < 64; t++ )
+    {
+        if ( t >= 16 )
+            w[ t & 15 ] = _mm512_add_epi32(
+                            _mm512_add_epi32( sig1_16( w[ ( t - 2 ) & 15 ] ),
+                                              w[ ( t - 7 ) & 15 ] ),
+                            _mm512_add_epi32( sig0_16( w[ ( t - 15 ) & 15 ] ),
+                                              w[ t & 15 ] ) );
+
+        tmp = _mm512_add_epi32(
+                  _mm512_add_epi32( H, Sig1_16( E ) ),
+                  _mm512_add_epi32( Ch16( E, F, G ),
+                                    _mm512_add_epi32(
+                                      _mm512_set1_epi32( sha256_K[ t ] ),
+                                      w[ t & 15 ] ) ) );
+        H = G;
+        G = F;
+        F = E;
+        E = _mm512_add_epi32( D, tmp );
+        D = C;
+        C = B;
+        B = A;
+        A = _mm512_add_epi32( tmp, _mm512_add_epi32( Sig0_16( B ),
+                                                     Maj16( B, C, D ) ) );
+    }
+
+    _mm512_storeu_si512( out[ 0 ], _mm512_add_epi32( s[ 0 ], A ) );
+    _mm512_storeu_si512( out[ 1 ], _mm512_add_epi32( s[ 1 ], B ) );
+    _mm512_storeu_si512( out[ 2 ], _mm512_add_epi32( s[ 2 ], C ) );
+    _mm512_storeu_si512( out[ 3 ], _mm512_add_epi32( s[ 3 ], D ) );
+    _mm512_storeu_si512( out[ 4 ], _mm512_add_epi32( s[ 4 ], E ) );
+    _mm512_storeu_si512( out[ 5 ], _mm512_add_epi32( s[ 5 ], F ) );
+    _mm512_storeu_si512( out[ 6 ], _mm512_add_epi32( s[ 6 ], G ) );
+    _mm512_storeu_si512( out[ 7 ], _mm512_add_epi32( s[ 7 ], H ) );
+
+    for ( i = 0; i < 8; i++ )
+        for ( t = 0; t < 16; t++ )
+            state[ t ][ i ] = out[ i ][ t ];
+}
+
+#else
+
+/* ISO C forbids an empty translation unit */
+
+typedef int sha256_x86_unused;
+
+#endif /* SHA256_HAVE_X86 */
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
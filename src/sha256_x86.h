@@ -0,0 +1,64 @@
+/*
+ *  Vectorized SHA256 compression kernels for x86 CPUs. They are
+ *  compiled with per-function target attributes so that the rest of
+ *  the program doesn't have to be built for a specific instruction
+ *  set; sha256.c only calls them after checking the CPU supports it.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#if ! defined SHA256_X86_HEADER_
+#define SHA256_X86_HEADER_
+
+#include "sha_types.h"
+
+
+#if ( defined __x86_64__ || defined __i386__ ) && defined __GNUC__
+#define SHA256_HAVE_X86  1
+#endif
+
+
+extern const sha_u32 sha256_K[ 64 ];
+
+
+#if defined SHA256_HAVE_X86
+
+int sha256_x86_has_avx2( void );
+int sha256_x86_has_avx512( void );
+int sha256_x86_has_shani( void );
+
+/* Drop-in replacement for the portable single block compression */
+
+void sha256_compress_shani( sha_u32 state[ 8 ],
+                            sha_u32 W[ 64 ] );
+
+/* Each kernel compresses one block per lane, W[ i ] holding the 16
+   message words of lane i and state[ i ] its chaining value */
+
+void sha256_x2_shani( sha_u32 state[ ][ 8 ],
+                      sha_u32 W[ ][ 16 ] );
+void sha256_x8_avx2( sha_u32 state[ ][ 8 ],
+                     sha_u32 W[ ][ 16 ] );
+void sha256_x16_avx512( sha_u32 state[ ][ 8 ],
+                        sha_u32 W[ ][ 16 ] );
+
+#endif
+
+
+#endif /* ! SHA256_X86_HEADER_ */
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chain.h"
+#include "search.h"
+#include "sort.h"
+
+#define SORT_BUCKETS (1 << SORT_RADIX_BITS)
+#define SORT_MAX_PASSES ((64 + SORT_RADIX_BITS - 1) / SORT_RADIX_BITS)
+
+
+int sort_records(struct sort_record *r, struct sort_record *scratch, size_t n,
+		unsigned int key_bits) {
+	unsigned int passes = (key_bits + SORT_RADIX_BITS - 1) / SORT_RADIX_BITS;
+	size_t (*counts)[SORT_BUCKETS];
+	struct sort_record *src = r, *dst = scratch;
+
+	if (n < 2 || passes == 0) {
+		return 0;
+	}
+
+	counts = calloc(passes, sizeof(*counts));
+	if (counts == NULL) {
+		return 1;
+	}
+
+	// the counts of all passes in one go, the keys don't change
+	for (size_t i = 0; i < n; i++) {
+		for (unsigned int p = 0; p < passes; p++) {
+			counts[p][(r[i].key >> (p * SORT_RADIX_BITS)) & (SORT_BUCKETS - 1)]++;
+		}
+	}
+
+	for (unsigned int p = 0; p < passes; p++) {
+		unsigned int shift = p * SORT_RADIX_BITS;
+		size_t offset = 0;
+
+		// all keys with the same digit, nothing to do
+		if (counts[p][(r[0].key >> shift) & (SORT_BUCKETS - 1)] == n) {
+			continue;
+		}
+
+		for (unsigned int b = 0; b < SORT_BUCKETS; b++) {
+			size_t c = counts[p][b];
+
+			counts[p][b] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			dst[counts[p][(src[i].key >> shift) & (SORT_BUCKETS - 1)]++] = src[i];
+		}
+
+		struct sort_record *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != r) {
+		memcpy(r, src, n * sizeof(*r));
+	}
+	free(counts);
+
+	return 0;
+}
+
+int sort_merge(struct sort_run *run, const struct sort_record *block, size_t n,
+		struct sort_pairs *candidates) {
+	size_t i = run->len, j = n, k = run->len + n;
+	struct sort_record *out = run->records;
+	int after_new = 0;
+
+	if (k > run->size) {
+		out = realloc(run->records, k * sizeof(*out));
+		if (out == NULL) {
+			return 1;
+		}
+		run->records = out;
+		run->size = k;
+	}
+
+	// from the back, so every record of the run is moved up before its
+	// slot gets written; once the block is used up the rest is in place
+	while (j > 0) {
+		// on equal keys the run's records go first, they're earlier
+		// steps, so the block's are taken first going backwards
+		int new = i == 0 || block[j - 1].key >= out[i - 1].key;
+		struct sort_record r = new ? block[--j] : out[--i];
+
+		// only pairs with a new record, the run's own were seen before
+		if (after_new && r.key == out[k].key &&
+				sort_pairs_add(candidates, r.step, out[k].step)) {
+			return 1;
+		}
+		out[--k] = r;
+		after_new = new;
+	}
+	if (after_new && k > 0 && out[k - 1].key == out[k].key &&
+			sort_pairs_add(candidates, out[k - 1].step, out[k].step)) {
+		return 1;
+	}
+	run->len += n;
+
+	return 0;
+}
+
+int sort_pairs_add(struct sort_pairs *p, unsigned long long first,
+		unsigned long long second) {
+	if (p->len == p->size) {
+		size_t size = p->size ? p->size * 2 : 64;
+		struct sort_pair *pairs = realloc(p->pairs, size * sizeof(*pairs));
+
+		if (pairs == NULL) {
+			return 1;
+		}
+		p->pairs = pairs;
+		p->size = size;
+	}
+
+	p->pairs[p->len].first = first;
+	p->pairs[p->len].second = second;
+	p->len++;
+
+	return 0;
+}
+
+void sort_fill_block(struct sort_record *block, size_t n, unsigned int chains,
+		unsigned char (*prev)[SHA256_HASH_SIZE], unsigned long long *steps) {
+	unsigned char hash[MAX_CHAINS][SHA256_HASH_SIZE];
+
+	for (size_t i = 0; i < n; i += chains) {
+		sha256_short_many(prev, SHA256_HASH_SIZE, bitlen, chains, hash[0]);
+
+		for (unsigned int c = 0; c < chains; c++) {
+			size_t len = trim_hash(hash[c]);
+
+			block[i + c].key = hash_key(hash[c]);
+			block[i + c].step = (*steps)++;
+			memcpy(prev[c], hash[c], len);
+		}
+	}
+}
+
+static int verify(unsigned long long a, unsigned long long b,
+		unsigned int chains, unsigned char *pa, unsigned char *pb,
+		unsigned char *hash) {
+	// equal keys are only equal hashes for prefixes of up to 64 bits,
+	// and different steps can hash the same value where chains merged
+	unsigned char hb[SHA256_HASH_SIZE];
+
+	chain_replay(a, chains, pa);
+	chain_replay(b, chains, pb);
+	chain_step(pa, hash);
+	chain_step(pb, hb);
+
+	return hash_equal(hash, hb) && !hash_equal(pa, pb);
+}
+
+static int cmp_later(const void *x, const void *y) {
+	const struct sort_pair *a = x, *b = y;
+
+	return (a->second > b->second) - (a->second < b->second);
+}
+
+int sort_resolve_candidates(struct sort_pairs *candidates, unsigned int chains) {
+	int found = 0;
+
+	// the earliest collision is the candidate with the lowest later
+	// step, everything after it where the chains merged repeats it
+	qsort(candidates->pairs, candidates->len, sizeof(*candidates->pairs),
+			cmp_later);
+	for (size_t i = 0; i < candidates->len && !found; i++) {
+		unsigned long long a = candidates->pairs[i].first;
+		unsigned long long b = candidates->pairs[i].second;
+		unsigned char pa[SHA256_HASH_SIZE], pb[SHA256_HASH_SIZE];
+		unsigned char h[SHA256_HASH_SIZE];
+
+		if (verify(a, b, chains, pa, pb, h)) {
+			printf("Found %u-bit collision after %llu iterations :: ",
+					bitlen, b);
+			print_hex(h, hashlen);
+			printf("\n");
+			printf("Data with the same hash:\n");
+			printf("\t");
+			print_hex(pa, hashlen);
+			printf(" (chain %u)\n\t", (unsigned int) ((a - 1) % chains));
+			print_hex(pb, hashlen);
+			printf(" (chain %u)\n", (unsigned int) ((b - 1) % chains));
+			found = 1;
+		}
+	}
+	candidates->len = 0;
+
+	return found;
+}
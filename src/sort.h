@@ -0,0 +1,65 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sha256.h"
+
+// Sorted runs of (key, step number) records for the sort-based search:
+// blocks are LSD radix sorted on the key, which is stable, so equal keys
+// stay in step order, and merged into one run while the equal neighbours
+// are collected as collision candidates.
+
+// bits of the key sorted on per pass
+#define SORT_RADIX_BITS 11
+
+struct sort_record {
+	uint64_t key;
+	uint64_t step;
+};
+
+struct sort_run {
+	struct sort_record *records;
+	size_t len;
+	// records allocated
+	size_t size;
+};
+
+// two steps with the same key, first < second
+struct sort_pair {
+	unsigned long long first;
+	unsigned long long second;
+};
+
+struct sort_pairs {
+	struct sort_pair *pairs;
+	size_t len;
+	size_t size;
+};
+
+// sorts n records on their lowest key_bits key bits, using scratch (room
+// for n records) in between; returns 0 on success and 1 if out of memory
+int sort_records(struct sort_record *r, struct sort_record *scratch, size_t n,
+		unsigned int key_bits);
+// merges a sorted block of records with later steps than all of the run's
+// into it, in place from the back (the run is grown first if it lacks room
+// for the block), and adds every new record with the same key as the one
+// before it to candidates; returns 0 on success and 1 if out of memory,
+// which leaves the run unusable
+int sort_merge(struct sort_run *run, const struct sort_record *block, size_t n,
+		struct sort_pairs *candidates);
+// returns 0 on success and 1 if out of memory
+int sort_pairs_add(struct sort_pairs *p, unsigned long long first,
+		unsigned long long second);
+
+// walks the chains on from their values in prev for n steps (whole
+// rounds), round-robin like table mode so that chain_replay() finds the
+// values again, filling in a record per step numbered from *steps on
+void sort_fill_block(struct sort_record *block, size_t n, unsigned int chains,
+		unsigned char (*prev)[SHA256_HASH_SIZE], unsigned long long *steps);
+// replays the candidates' steps, earliest later step first, and prints
+// the first one that is a real collision; returns 1 if there was one and
+// 0 if not, emptying candidates either way
+int sort_resolve_candidates(struct sort_pairs *candidates, unsigned int chains);
+
+#endif //SORT_H
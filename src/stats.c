@@ -0,0 +1,234 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "chain.h"
+#include "stats.h"
+
+
+uint64_t stats_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void latency_add(struct latency *l, uint64_t ns) {
+	// the top bit picks the power of two, the ones after it the quarter
+	unsigned int b = ns;
+
+	if (ns >= 1 << LATENCY_SUB_BITS) {
+		unsigned int msb = 63 - __builtin_clzll(ns);
+
+		b = ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+				((ns >> (msb - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+	}
+
+	l->buckets[b]++;
+	l->count++;
+}
+
+uint64_t latency_percentile(const struct latency *l, double p) {
+	uint64_t want = ceil(p * l->count);
+	uint64_t seen = 0;
+
+	for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+		seen += l->buckets[b];
+		if (seen >= want && seen > 0) {
+			if (b < 1 << LATENCY_SUB_BITS) {
+				return b;
+			}
+
+			unsigned int shift = (b >> LATENCY_SUB_BITS) - 1;
+			uint64_t sub = b & ((1 << LATENCY_SUB_BITS) - 1);
+
+			return (((1 << LATENCY_SUB_BITS) + sub + 1) << shift) - 1;
+		}
+	}
+
+	return 0;
+}
+
+static double now(void) {
+	return stats_now_ns() / 1e9;
+}
+
+static size_t resident_bytes(void) {
+	// second field of statm, in pages
+	FILE *f = fopen("/proc/self/statm", "r");
+	unsigned long size, resident = 0;
+
+	if (f != NULL) {
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(f);
+	}
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void format_secs(double secs, char *buf, size_t len) {
+	unsigned long long s = secs;
+
+	if (!isfinite(secs) || secs > 1e15) {
+		snprintf(buf, len, "never");
+	} else if (s >= 86400) {
+		snprintf(buf, len, "%llud %02lluh", s / 86400, s / 3600 % 24);
+	} else if (s >= 3600) {
+		snprintf(buf, len, "%lluh %02llum", s / 3600, s / 60 % 60);
+	} else {
+		snprintf(buf, len, "%llum %02llus", s / 60, s % 60);
+	}
+}
+
+static void write_latency(FILE *f, const char *op, const struct latency *l,
+		const char *labels) {
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+		fprintf(f, "shacollider_store_latency_seconds{%s,op=\"%s\",quantile=\"%g\"} %g\n",
+				labels, op, quantiles[i], latency_percentile(l, quantiles[i]) / 1e9);
+	}
+	fprintf(f, "shacollider_store_latency_seconds_count{%s,op=\"%s\"} %llu\n",
+			labels, op, (unsigned long long) l->count);
+}
+
+static void write_metrics(const struct stats *s, const struct stats_sample *x,
+		double rate, double fill, double fpr, size_t rss, double expected,
+		double eta, double chance) {
+	// written next to the real file and renamed over it,
+	// so a scrape never sees half of it
+	char tmp[PATH_MAX], labels[64];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", s->metrics_path);
+	snprintf(labels, sizeof(labels), "mode=\"%s\",bits=\"%u\"", s->mode, bitlen);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		return;
+	}
+
+	fprintf(f, "# HELP shacollider_steps_total Hashes computed so far.\n");
+	fprintf(f, "# TYPE shacollider_steps_total counter\n");
+	fprintf(f, "shacollider_steps_total{%s} %llu\n", labels, x->steps);
+	fprintf(f, "# HELP shacollider_steps_per_second Hashes per second since the last report.\n");
+	fprintf(f, "# TYPE shacollider_steps_per_second gauge\n");
+	fprintf(f, "shacollider_steps_per_second{%s} %.0f\n", labels, rate);
+	fprintf(f, "# HELP shacollider_store_queries_total Filter hits that weren't in the store.\n");
+	fprintf(f, "# TYPE shacollider_store_queries_total counter\n");
+	fprintf(f, "shacollider_store_queries_total{%s} %llu\n", labels, x->queries);
+	fprintf(f, "# HELP shacollider_filter_false_positive_rate Store queries per step so far.\n");
+	fprintf(f, "# TYPE shacollider_filter_false_positive_rate gauge\n");
+	fprintf(f, "shacollider_filter_false_positive_rate{%s} %g\n", labels, fpr);
+	if (x->filter != NULL) {
+		fprintf(f, "# HELP shacollider_filter_fill_ratio Fraction of filter bits or slots set.\n");
+		fprintf(f, "# TYPE shacollider_filter_fill_ratio gauge\n");
+		fprintf(f, "shacollider_filter_fill_ratio{%s,filter=\"%s\"} %g\n", labels,
+				x->filter->ops->name, fill);
+		fprintf(f, "# HELP shacollider_filter_bytes Memory used by the filter.\n");
+		fprintf(f, "# TYPE shacollider_filter_bytes gauge\n");
+		fprintf(f, "shacollider_filter_bytes{%s,filter=\"%s\"} %zu\n", labels,
+				x->filter->ops->name, x->filter->ops->bytes(x->filter));
+	}
+	if (x->queue_slots > 0) {
+		fprintf(f, "# HELP shacollider_queue_fill_ratio Fraction of the ring buffer slots in use.\n");
+		fprintf(f, "# TYPE shacollider_queue_fill_ratio gauge\n");
+		fprintf(f, "shacollider_queue_fill_ratio{%s} %g\n", labels,
+				(double) x->queued / x->queue_slots);
+		fprintf(f, "# HELP shacollider_producer_stalls_total Times a producer found its ring full.\n");
+		fprintf(f, "# TYPE shacollider_producer_stalls_total counter\n");
+		fprintf(f, "shacollider_producer_stalls_total{%s} %llu\n", labels, x->stalls);
+		fprintf(f, "# HELP shacollider_producer_stall_seconds_total Time producers waited for room.\n");
+		fprintf(f, "# TYPE shacollider_producer_stall_seconds_total counter\n");
+		fprintf(f, "shacollider_producer_stall_seconds_total{%s} %g\n", labels,
+				x->stall_secs);
+	}
+	fprintf(f, "# HELP shacollider_store_latency_seconds Store operation latency.\n");
+	fprintf(f, "# TYPE shacollider_store_latency_seconds summary\n");
+	write_latency(f, "get", &s->get, labels);
+	write_latency(f, "put", &s->put, labels);
+	fprintf(f, "# HELP shacollider_resident_memory_bytes Resident set size.\n");
+	fprintf(f, "# TYPE shacollider_resident_memory_bytes gauge\n");
+	fprintf(f, "shacollider_resident_memory_bytes{%s} %zu\n", labels, rss);
+	fprintf(f, "# HELP shacollider_birthday_expected_steps Expected steps to a collision.\n");
+	fprintf(f, "# TYPE shacollider_birthday_expected_steps gauge\n");
+	fprintf(f, "shacollider_birthday_expected_steps{%s} %g\n", labels, expected);
+	fprintf(f, "# HELP shacollider_eta_seconds Time until the expected number of steps.\n");
+	fprintf(f, "# TYPE shacollider_eta_seconds gauge\n");
+	fprintf(f, "shacollider_eta_seconds{%s} %g\n", labels, eta);
+	fprintf(f, "# HELP shacollider_collision_probability Chance a collision is among the steps so far.\n");
+	fprintf(f, "# TYPE shacollider_collision_probability gauge\n");
+	fprintf(f, "shacollider_collision_probability{%s} %g\n", labels, chance);
+
+	if (fclose(f) || rename(tmp, s->metrics_path)) {
+		remove(tmp);
+	}
+}
+
+
+void stats_init(struct stats *s, unsigned int interval, const char *metrics_path,
+		const char *mode, unsigned long long steps) {
+	*s = (struct stats) {
+		.interval = interval,
+		.metrics_path = metrics_path,
+		.mode = mode,
+		.next = time(NULL) + interval,
+		.last_time = now(),
+		.last_steps = steps,
+	};
+}
+
+void stats_tick(struct stats *s, const struct stats_sample *x) {
+	if (s->interval > 0 && time(NULL) >= s->next) {
+		s->next = time(NULL) + s->interval;
+		stats_report(s, x);
+	}
+}
+
+void stats_report(struct stats *s, const struct stats_sample *x) {
+	double t = now();
+	double rate = (x->steps - s->last_steps) / (t - s->last_time);
+	double fill = x->filter != NULL && x->filter->ops->fill != NULL ?
+			x->filter->ops->fill(x->filter) : 0;
+	double fpr = x->steps ? (double) x->queries / x->steps : 0;
+	size_t rss = resident_bytes();
+	// birthday bound: a collision among n random bitlen-bit values is
+	// expected after sqrt(pi/2 * 2^bitlen) of them, and there is one
+	// among n with chance 1 - exp(-n^2 / 2^(bitlen+1))
+	double space = ldexp(1, bitlen);
+	double expected = sqrt(M_PI / 2 * space);
+	double chance = -expm1(-(double) x->steps * x->steps / (2 * space));
+	double eta = x->steps >= expected ? 0 : (expected - x->steps) / rate;
+	char eta_buf[32];
+
+	format_secs(eta, eta_buf, sizeof(eta_buf));
+	fprintf(stderr, "%.1fM steps, %.2fM/s, FPR %.6f", x->steps / 1e6,
+			rate / 1e6, fpr);
+	if (x->filter != NULL) {
+		fprintf(stderr, ", filter %.1f%% full", 100 * fill);
+	}
+	if (x->queue_slots > 0) {
+		fprintf(stderr, ", queue %.0f%% full, %llu stalls (%.1fs)",
+				100.0 * x->queued / x->queue_slots, x->stalls, x->stall_secs);
+	}
+	if (s->get.count > 0) {
+		fprintf(stderr, ", get p50/p99 %.1f/%.1fus",
+				latency_percentile(&s->get, 0.5) / 1e3,
+				latency_percentile(&s->get, 0.99) / 1e3);
+	}
+	if (s->put.count > 0) {
+		fprintf(stderr, ", put p50/p99 %.1f/%.1fus",
+				latency_percentile(&s->put, 0.5) / 1e3,
+				latency_percentile(&s->put, 0.99) / 1e3);
+	}
+	fprintf(stderr, ", RSS %.1f MB, ETA %s (%.0f%% chance so far)\n",
+			(double) rss / 1024 / 1024, eta_buf, 100 * chance);
+
+	if (s->metrics_path != NULL) {
+		write_metrics(s, x, rate, fill, fpr, rss, expected, eta, chance);
+	}
+
+	s->last_time = t;
+	s->last_steps = x->steps;
+}
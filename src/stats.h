@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "filter.h"
+
+// Periodic progress reports of a running search: a line on stderr and,
+// if asked for, a Prometheus text file (node_exporter's textfile format)
+// rewritten every time.
+
+// latency histogram buckets: four per power of two of nanoseconds,
+// so percentiles are within about 20%
+#define LATENCY_SUB_BITS 2
+#define LATENCY_BUCKETS (64 << LATENCY_SUB_BITS)
+
+struct latency {
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t count;
+};
+
+struct stats {
+	// seconds between reports, 0 for none, and the metrics file or NULL
+	unsigned int interval;
+	const char *metrics_path;
+	const char *mode;
+	time_t next;
+
+	// where the last report left off, for the rates
+	double last_time;
+	unsigned long long last_steps;
+
+	// store operations, filled in by the search
+	struct latency get;
+	struct latency put;
+};
+
+// what the search is at, the filter may be NULL
+struct stats_sample {
+	unsigned long long steps;
+	unsigned long long queries;
+	const struct filter *filter;
+	// pipe mode's rings, all 0 for the other modes: records queued and
+	// room for them, and how often and long the producers waited for room
+	unsigned long long queued;
+	unsigned long long queue_slots;
+	unsigned long long stalls;
+	double stall_secs;
+};
+
+// monotonic clock in nanoseconds, for timing store operations
+uint64_t stats_now_ns(void);
+void latency_add(struct latency *l, uint64_t ns);
+// upper bound of the bucket the given fraction of the values are in
+uint64_t latency_percentile(const struct latency *l, double p);
+
+void stats_init(struct stats *s, unsigned int interval, const char *metrics_path,
+		const char *mode, unsigned long long steps);
+// reports if the interval is up; cheap, but calls time()
+void stats_tick(struct stats *s, const struct stats_sample *x);
+// reports no matter what, eg. when the search is done
+void stats_report(struct stats *s, const struct stats_sample *x);
+
+#endif //STATS_H
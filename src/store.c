@@ -0,0 +1,30 @@
+#include <string.h>
+#include "store.h"
+
+
+const struct store_ops *const store_backends[] = {
+	&store_leveldb,
+	&store_memenv,
+	&store_mmap,
+	NULL,
+};
+
+const struct store_ops *store_find(const char *name) {
+	for (size_t i = 0; store_backends[i] != NULL; i++) {
+		if (strcmp(name, store_backends[i]->name) == 0) {
+			return store_backends[i];
+		}
+	}
+
+	return NULL;
+}
+
+int store_open(struct store *s, const struct store_ops *ops,
+		size_t key_len, size_t val_len, size_t capacity, int resume) {
+	s->ops = ops;
+	s->key_len = key_len;
+	s->val_len = val_len;
+	s->priv = NULL;
+
+	return ops->open(s, capacity, resume);
+}
@@ -0,0 +1,54 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+
+// Storage backends used to verify bloom filter hits: a store maps
+// fixed-length keys (trimmed hashes) to fixed-length values (their
+// preimages), every backend implements the same few operations.
+
+struct store;
+
+struct store_ops {
+	const char *name;
+	const char *description;
+	// set up an empty store for about capacity records, or with resume
+	// set reopen the one an earlier run kept; returns 0 on success
+	int (*open)(struct store *s, size_t capacity, int resume);
+	// add or replace a record, returns 0 on success
+	int (*put)(struct store *s, const void *key, const void *val);
+	// look a key up, returns 1 and fills in val if it's there,
+	// 0 if it isn't and -1 on errors
+	int (*get)(struct store *s, const void *key, void *val);
+	// make everything put so far survive a crash, returns 0 on success;
+	// NULL for stores that don't outlive the process
+	int (*sync)(struct store *s);
+	// close the store and remove its data unless keep is set (to resume
+	// later), returns 0 on success
+	int (*close)(struct store *s, int keep);
+};
+
+struct store {
+	const struct store_ops *ops;
+	size_t key_len;
+	size_t val_len;
+	// backend specific state
+	void *priv;
+};
+
+// NULL terminated list of all backends, the first one is the default
+extern const struct store_ops *const store_backends[];
+
+// LevelDB on disk, tuned for lots of small random writes
+extern const struct store_ops store_leveldb;
+// LevelDB on an in-memory environment
+extern const struct store_ops store_memenv;
+// open addressing hash table in a memory mapped file
+extern const struct store_ops store_mmap;
+
+// returns the backend with the given name, or NULL
+const struct store_ops *store_find(const char *name);
+int store_open(struct store *s, const struct store_ops *ops,
+		size_t key_len, size_t val_len, size_t capacity, int resume);
+
+#endif //STORE_H
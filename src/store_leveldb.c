@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbwriter.h"
+#include "leveldb/include/leveldb/c.h"
+#include "memenv.h"
+#include "store.h"
+
+// LevelDB backends, on disk or all in memory (through memenv.h, as the
+// C API has no in-memory environment). Keys are random so there's
+// nothing to gain from compression, while a large write buffer and a
+// filter policy keep compactions rare and negative lookups (false bloom
+// filter positives) from going to the table files. All puts go through a
+// background writer thread, so hashing never waits for LevelDB; lookups
+// find the records it hasn't committed yet in its queue.
+
+#define LEVELDB_NAME "shadb"
+#define LEVELDB_WRITE_BUFFER (64UL << 20)
+#define LEVELDB_CACHE (32UL << 20)
+#define LEVELDB_FILTER_BITS 10
+// records the writer thread can fall behind by, and how many of them
+// go into one WriteBatch
+#define WRITER_SLOTS (1UL << 20)
+#define WRITER_BATCH 65536
+
+
+struct leveldb_store {
+	// on disk, through the C API
+	leveldb_t *db;
+	leveldb_options_t *options;
+	leveldb_readoptions_t *roptions;
+	leveldb_writeoptions_t *woptions;
+	// for the (empty) write that flushes the log to disk
+	leveldb_writeoptions_t *sync_woptions;
+	leveldb_filterpolicy_t *filter;
+	leveldb_cache_t *cache;
+	leveldb_writebatch_t *batch;
+	// or in memory
+	struct memenv_db *mem;
+	size_t key_len;
+	size_t val_len;
+	struct dbwriter writer;
+};
+
+
+static void leveldb_store_free(struct leveldb_store *l) {
+	if (l->mem != NULL) {
+		memenv_close(l->mem);
+	} else {
+		leveldb_options_destroy(l->options);
+		leveldb_readoptions_destroy(l->roptions);
+		leveldb_writeoptions_destroy(l->woptions);
+		leveldb_writeoptions_destroy(l->sync_woptions);
+		leveldb_filterpolicy_destroy(l->filter);
+		leveldb_cache_destroy(l->cache);
+		leveldb_writebatch_destroy(l->batch);
+	}
+	free(l);
+}
+
+// the writer thread's ends of the two kinds of store
+
+static int leveldb_disk_write(void *db, const unsigned char *recs, size_t n) {
+	struct leveldb_store *l = db;
+	const char *rec = (const char *) recs;
+	char *err = NULL;
+
+	leveldb_writebatch_clear(l->batch);
+	for (size_t i = 0; i < n; i++, rec += l->key_len + l->val_len) {
+		leveldb_writebatch_put(l->batch, rec, l->key_len, rec + l->key_len,
+				l->val_len);
+	}
+
+	leveldb_write(l->db, l->woptions, l->batch, &err);
+	if (err != NULL) {
+		leveldb_free(err);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int leveldb_mem_write(void *db, const unsigned char *recs, size_t n) {
+	struct leveldb_store *l = db;
+
+	return memenv_write(l->mem, recs, n, l->key_len, l->val_len);
+}
+
+static int leveldb_disk_open(struct store *s, size_t capacity, int resume) {
+	struct leveldb_store *l = calloc(1, sizeof(*l));
+	char *err = NULL;
+
+	if (l == NULL) {
+		return 1;
+	}
+	l->key_len = s->key_len;
+	l->val_len = s->val_len;
+
+	l->options = leveldb_options_create();
+	l->roptions = leveldb_readoptions_create();
+	l->woptions = leveldb_writeoptions_create();
+	l->sync_woptions = leveldb_writeoptions_create();
+	leveldb_writeoptions_set_sync(l->sync_woptions, 1);
+	l->filter = leveldb_filterpolicy_create_bloom(LEVELDB_FILTER_BITS);
+	l->cache = leveldb_cache_create_lru(LEVELDB_CACHE);
+	l->batch = leveldb_writebatch_create();
+
+	leveldb_options_set_create_if_missing(l->options, 1);
+	leveldb_options_set_compression(l->options, leveldb_no_compression);
+	leveldb_options_set_write_buffer_size(l->options, LEVELDB_WRITE_BUFFER);
+	leveldb_options_set_filter_policy(l->options, l->filter);
+	leveldb_options_set_cache(l->options, l->cache);
+
+	if (!resume) {
+		// whatever an interrupted run left behind
+		leveldb_destroy_db(l->options, LEVELDB_NAME, &err);
+		leveldb_free(err);
+		err = NULL;
+	}
+
+	l->db = leveldb_open(l->options, LEVELDB_NAME, &err);
+	if (err != NULL) {
+		printf("Failed to create/open the LevelDB database: %s\n", err);
+		leveldb_free(err);
+		leveldb_store_free(l);
+		return 1;
+	}
+
+	if (dbwriter_start(&l->writer, leveldb_disk_write, l, s->key_len,
+			s->val_len, WRITER_SLOTS, WRITER_BATCH)) {
+		printf("Failed to start the LevelDB writer thread.\n");
+		leveldb_close(l->db);
+		// the store a checkpoint refers to has to stay
+		if (!resume) {
+			leveldb_destroy_db(l->options, LEVELDB_NAME, &err);
+			leveldb_free(err);
+		}
+		leveldb_store_free(l);
+		return 1;
+	}
+
+	s->priv = l;
+	return 0;
+}
+
+static int leveldb_mem_open(struct store *s, size_t capacity, int resume) {
+	struct leveldb_store *l;
+
+	if (resume) {
+		printf("The memenv store doesn't survive restarts, can't resume.\n");
+		return 1;
+	}
+
+	l = calloc(1, sizeof(*l));
+	if (l == NULL) {
+		return 1;
+	}
+	l->key_len = s->key_len;
+	l->val_len = s->val_len;
+	l->mem = memenv_open(LEVELDB_NAME, LEVELDB_WRITE_BUFFER, LEVELDB_CACHE,
+			LEVELDB_FILTER_BITS);
+	if (l->mem == NULL) {
+		free(l);
+		return 1;
+	}
+
+	if (dbwriter_start(&l->writer, leveldb_mem_write, l, s->key_len,
+			s->val_len, WRITER_SLOTS, WRITER_BATCH)) {
+		printf("Failed to start the LevelDB writer thread.\n");
+		leveldb_store_free(l);
+		return 1;
+	}
+
+	s->priv = l;
+	return 0;
+}
+
+static int leveldb_store_put(struct store *s, const void *key, const void *val) {
+	struct leveldb_store *l = s->priv;
+
+	return dbwriter_put(&l->writer, key, val);
+}
+
+static int leveldb_store_get(struct store *s, const void *key, void *val) {
+	struct leveldb_store *l = s->priv;
+	char *err = NULL;
+	char *read;
+	size_t read_len;
+
+	// the key may still be waiting in the writer's queue, if it isn't
+	// there it's either in LevelDB or nowhere
+	if (dbwriter_get(&l->writer, key, val)) {
+		return 1;
+	}
+	if (atomic_load(&l->writer.failed)) {
+		return -1;
+	}
+	if (l->mem != NULL) {
+		return memenv_get(l->mem, key, s->key_len, val, s->val_len);
+	}
+
+	read = leveldb_get(l->db, l->roptions, key, s->key_len, &read_len, &err);
+	if (err != NULL) {
+		leveldb_free(err);
+		return -1;
+	}
+	if (read == NULL) {
+		return 0;
+	}
+
+	memcpy(val, read, read_len < s->val_len ? read_len : s->val_len);
+	leveldb_free(read);
+	return 1;
+}
+
+static int leveldb_store_sync(struct store *s) {
+	struct leveldb_store *l = s->priv;
+	char *err = NULL;
+
+	if (dbwriter_sync(&l->writer)) {
+		return 1;
+	}
+
+	// LevelDB has no explicit flush, but a synchronous write
+	// fsyncs the log along with everything before it
+	leveldb_writebatch_t *batch = leveldb_writebatch_create();
+	leveldb_write(l->db, l->sync_woptions, batch, &err);
+	leveldb_writebatch_destroy(batch);
+	if (err != NULL) {
+		leveldb_free(err);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int leveldb_store_close(struct store *s, int keep) {
+	struct leveldb_store *l = s->priv;
+	char *err = NULL;
+	int ret = 0;
+
+	if (dbwriter_stop(&l->writer)) {
+		ret = 1;
+	}
+
+	// the in-memory one goes away with its environment
+	if (l->mem == NULL) {
+		leveldb_close(l->db);
+		if (!keep) {
+			leveldb_destroy_db(l->options, LEVELDB_NAME, &err);
+		}
+	}
+	if (err != NULL) {
+		printf("%s\n", err);
+		printf("Failed to destroy LevelDB!\n");
+		leveldb_free(err);
+		ret = 1;
+	}
+
+	leveldb_store_free(l);
+	s->priv = NULL;
+	return ret;
+}
+
+const struct store_ops store_leveldb = {
+	.name = "leveldb",
+	.description = "LevelDB on disk (default)",
+	.open = leveldb_disk_open,
+	.put = leveldb_store_put,
+	.get = leveldb_store_get,
+	.sync = leveldb_store_sync,
+	.close = leveldb_store_close,
+};
+
+const struct store_ops store_memenv = {
+	.name = "memenv",
+	.description = "LevelDB on an in-memory environment",
+	.open = leveldb_mem_open,
+	.put = leveldb_store_put,
+	.get = leveldb_store_get,
+	.sync = NULL,
+	.close = leveldb_store_close,
+};
@@ -0,0 +1,175 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "store.h"
+
+// Flat open addressing hash table (linear probing) in a memory mapped
+// file, so the kernel decides what stays in RAM. Every slot is a flag byte
+// followed by the key and value; keys are hashes already, so their first
+// bytes are used as the slot index as they are.
+
+#define MMAP_NAME "shadb.flat"
+// fraction of the slots that may be used
+#define MMAP_MAX_LOAD 0.75
+
+
+struct mmap_store {
+	unsigned char *slots;
+	size_t num_slots;
+	size_t slot_len;
+	size_t used;
+	size_t bytes;
+};
+
+
+static size_t mmap_index(const struct store *s, const void *key) {
+	const struct mmap_store *m = s->priv;
+	uint64_t x = 0;
+
+	memcpy(&x, key, s->key_len < sizeof(x) ? s->key_len : sizeof(x));
+	return x & (m->num_slots - 1);
+}
+
+static int mmap_open(struct store *s, size_t capacity, int resume) {
+	struct mmap_store *m = calloc(1, sizeof(*m));
+	struct stat st;
+	int fd;
+
+	if (m == NULL) {
+		return 1;
+	}
+
+	m->num_slots = 1;
+	while (m->num_slots * MMAP_MAX_LOAD < capacity) {
+		m->num_slots *= 2;
+	}
+	m->slot_len = 1 + s->key_len + s->val_len;
+	m->bytes = m->num_slots * m->slot_len;
+
+	if (resume) {
+		// the table kept by an earlier run, it has to be the same size
+		fd = open(MMAP_NAME, O_RDWR);
+		if (fd < 0 || fstat(fd, &st) || (size_t) st.st_size != m->bytes) {
+			printf("Failed to reopen %s, or it has the wrong size.\n",
+					MMAP_NAME);
+			if (fd >= 0) {
+				close(fd);
+			}
+			free(m);
+			return 1;
+		}
+	} else {
+		// a sparse file, untouched slots don't take any space
+		fd = open(MMAP_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, m->bytes)) {
+			printf("Failed to create %s.\n", MMAP_NAME);
+			if (fd >= 0) {
+				close(fd);
+			}
+			free(m);
+			return 1;
+		}
+	}
+
+	m->slots = mmap(NULL, m->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m->slots == MAP_FAILED) {
+		printf("Failed to map %.2f MB of %s.\n",
+				(double) m->bytes / 1024 / 1024, MMAP_NAME);
+		if (!resume) {
+			unlink(MMAP_NAME);
+		}
+		free(m);
+		return 1;
+	}
+
+	for (size_t i = 0; resume && i < m->num_slots; i++) {
+		m->used += m->slots[i * m->slot_len];
+	}
+
+	s->priv = m;
+	return 0;
+}
+
+static int mmap_put(struct store *s, const void *key, const void *val) {
+	struct mmap_store *m = s->priv;
+	size_t i = mmap_index(s, key);
+
+	for (;;) {
+		unsigned char *slot = m->slots + i * m->slot_len;
+
+		if (!slot[0]) {
+			if (m->used + 1 > m->num_slots * MMAP_MAX_LOAD) {
+				// it's sized up front, unlike the growing filters
+				printf("The mmap store is full.\n");
+				return 1;
+			}
+			slot[0] = 1;
+			memcpy(slot + 1, key, s->key_len);
+			memcpy(slot + 1 + s->key_len, val, s->val_len);
+			m->used++;
+			return 0;
+		}
+		if (memcmp(slot + 1, key, s->key_len) == 0) {
+			memcpy(slot + 1 + s->key_len, val, s->val_len);
+			return 0;
+		}
+
+		i = (i + 1) & (m->num_slots - 1);
+	}
+}
+
+static int mmap_get(struct store *s, const void *key, void *val) {
+	struct mmap_store *m = s->priv;
+	size_t i = mmap_index(s, key);
+
+	for (;;) {
+		const unsigned char *slot = m->slots + i * m->slot_len;
+
+		if (!slot[0]) {
+			return 0;
+		}
+		if (memcmp(slot + 1, key, s->key_len) == 0) {
+			memcpy(val, slot + 1 + s->key_len, s->val_len);
+			return 1;
+		}
+
+		i = (i + 1) & (m->num_slots - 1);
+	}
+}
+
+static int mmap_sync(struct store *s) {
+	struct mmap_store *m = s->priv;
+
+	return msync(m->slots, m->bytes, MS_SYNC) != 0;
+}
+
+static int mmap_close(struct store *s, int keep) {
+	struct mmap_store *m = s->priv;
+
+	munmap(m->slots, m->bytes);
+	free(m);
+	s->priv = NULL;
+
+	if (!keep && unlink(MMAP_NAME)) {
+		printf("Failed to remove %s!\n", MMAP_NAME);
+		return 1;
+	}
+
+	return 0;
+}
+
+const struct store_ops store_mmap = {
+	.name = "mmap",
+	.description = "hash table in a memory mapped file, no LevelDB",
+	.open = mmap_open,
+	.put = mmap_put,
+	.get = mmap_get,
+	.sync = mmap_sync,
+	.close = mmap_close,
+};
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include "mem.h"
+#include "table.h"
+
+#define MASK(bits) ((bits) >= 64 ? ~0ULL : (1ULL << (bits)) - 1)
+
+// what a table's file keeps in its header besides the slots
+struct table_state {
+	uint64_t used;
+	unsigned char user[TABLE_USER_BYTES];
+};
+
+
+static inline uint64_t slot_read(const struct table *t, size_t i) {
+	size_t bit = i * t->slot_bits;
+	size_t word = bit / 64;
+	unsigned int off = bit % 64;
+	uint64_t v = t->words[word] >> off;
+
+	if (off + t->slot_bits > 64) {
+		v |= t->words[word + 1] << (64 - off);
+	}
+
+	return v & MASK(t->slot_bits);
+}
+
+static inline void slot_write(struct table *t, size_t i, uint64_t v) {
+	size_t bit = i * t->slot_bits;
+	size_t word = bit / 64;
+	unsigned int off = bit % 64;
+	uint64_t mask = MASK(t->slot_bits);
+
+	t->words[word] = (t->words[word] & ~(mask << off)) | (v << off);
+	if (off + t->slot_bits > 64) {
+		unsigned int spill = 64 - off;
+		t->words[word + 1] = (t->words[word + 1] & ~(mask >> spill)) | (v >> spill);
+	}
+}
+
+static unsigned int slot_shift(size_t capacity) {
+	// smallest power of two that keeps the load below the limit
+	unsigned int shift = 0;
+
+	while ((double) ((size_t) 1 << shift) * TABLE_MAX_LOAD < capacity) {
+		shift++;
+	}
+
+	return shift;
+}
+
+unsigned int table_max_key_bits(size_t capacity, unsigned int val_bits) {
+	// the top slot_shift bits of a key are its home slot
+	int bits = 64 - TABLE_DISP_BITS - (int) val_bits + (int) slot_shift(capacity);
+
+	return bits < 0 ? 0 : bits > 64 ? 64 : bits;
+}
+
+int table_init(struct table *t, size_t capacity, unsigned int key_bits,
+		unsigned int val_bits, const char *path) {
+	unsigned int shift = slot_shift(capacity);
+
+	t->words = NULL;
+	t->bytes = 0;
+	t->used = 0;
+	t->attached = 0;
+	t->user = NULL;
+	t->file_used = NULL;
+	t->capacity = capacity;
+	t->val_bits = val_bits;
+
+	t->slots = (size_t) 1 << shift;
+	t->rem_bits = key_bits > shift ? key_bits - shift : 0;
+	t->slot_bits = t->rem_bits + TABLE_DISP_BITS + val_bits;
+	if (key_bits > 64 || val_bits == 0 || t->slot_bits > 64) {
+		return 1;
+	}
+
+	// one more word so that reading the last slot never goes past the end
+	t->bytes = ((t->slots * t->slot_bits + 63) / 64 + 1) * sizeof(uint64_t);
+	if (path == NULL) {
+		t->words = mem_alloc(t->bytes);
+		return t->words == NULL;
+	}
+
+	uint64_t layout[] = { t->slots, t->slot_bits, t->rem_bits, t->val_bits,
+			t->capacity };
+	t->words = mem_map_file(path, "table", layout, sizeof(layout), t->bytes,
+			&t->attached);
+	if (t->words == NULL) {
+		return 1;
+	}
+
+	struct table_state *state = mem_file_state(t->words);
+	t->used = state->used;
+	t->user = state->user;
+	t->file_used = &state->used;
+
+	return 0;
+}
+
+int table_insert(struct table *t, uint64_t key, uint64_t val, uint64_t *old) {
+	uint64_t rem = key & MASK(t->rem_bits);
+	size_t i = (key >> t->rem_bits) & (t->slots - 1);
+
+	if (t->used >= t->capacity || val > MASK(t->val_bits)) {
+		return -1;
+	}
+
+	for (uint64_t disp = 0; disp <= TABLE_MAX_DISP; disp++) {
+		uint64_t slot = slot_read(t, i);
+		uint64_t v = slot >> (t->rem_bits + TABLE_DISP_BITS);
+
+		if (v == 0) {
+			slot_write(t, i, (val << (t->rem_bits + TABLE_DISP_BITS)) |
+					(disp << t->rem_bits) | rem);
+			t->used++;
+			if (t->file_used != NULL) {
+				*t->file_used = t->used;
+			}
+			return 0;
+		}
+		// same remainder and same home slot means same key
+		if ((slot & MASK(t->rem_bits + TABLE_DISP_BITS)) ==
+				((disp << t->rem_bits) | rem)) {
+			*old = v;
+			return 1;
+		}
+
+		i = (i + 1) & (t->slots - 1);
+	}
+
+	// probe sequence too long to record the displacement
+	return -2;
+}
+
+void table_prefetch(const struct table *t, uint64_t key) {
+	size_t i = (key >> t->rem_bits) & (t->slots - 1);
+
+	__builtin_prefetch(&t->words[i * t->slot_bits / 64], 1);
+}
+
+uint64_t table_get(const struct table *t, uint64_t key) {
+	uint64_t rem = key & MASK(t->rem_bits);
+	size_t i = (key >> t->rem_bits) & (t->slots - 1);
+
+	for (uint64_t disp = 0; disp <= TABLE_MAX_DISP; disp++) {
+		uint64_t slot = slot_read(t, i);
+		uint64_t v = slot >> (t->rem_bits + TABLE_DISP_BITS);
+
+		if (v == 0) {
+			break;
+		}
+		if ((slot & MASK(t->rem_bits + TABLE_DISP_BITS)) ==
+				((disp << t->rem_bits) | rem)) {
+			return v;
+		}
+
+		i = (i + 1) & (t->slots - 1);
+	}
+
+	return 0;
+}
+
+void table_free(struct table *t) {
+	mem_free(t->words);
+	t->words = NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Exact in-memory hash table mapping uniformly random keys of up to 64
+// bits to non-zero values, bit-packed with no padding between slots.
+//
+// Slots are addressed by the top bits of the key, so only the remaining
+// low key bits are stored, plus the distance from the home slot (linear
+// probing) which makes the quotient recoverable. A slot thus takes
+// key_bits - log2(slots) + TABLE_DISP_BITS + val_bits bits.
+
+#define TABLE_DISP_BITS 8
+// probes no further than this from a key's home slot
+#define TABLE_MAX_DISP ((1U << TABLE_DISP_BITS) - 1)
+// how full the table may get before inserts fail
+#define TABLE_MAX_LOAD 0.75
+// room for the caller's own state in the file a table is kept in, the
+// rest of MEM_FILE_STATE goes to the table's own
+#define TABLE_USER_BYTES 768
+
+struct table {
+	uint64_t *words;
+	size_t slots;
+	size_t used;
+	size_t capacity;
+	size_t bytes;
+	unsigned int slot_bits;
+	unsigned int rem_bits;
+	unsigned int val_bits;
+	// with a file: whether table_init() found entries there already, and
+	// TABLE_USER_BYTES kept along with them for the caller (zeroed in a
+	// new file; NULL without a file)
+	int attached;
+	void *user;
+	// the file's copy of used, kept up to date so that a killed run
+	// doesn't lose it; NULL without a file
+	uint64_t *file_used;
+};
+
+// the longest keys a table for up to capacity entries with val_bits
+// values fits into its (at most 64-bit) slots
+unsigned int table_max_key_bits(size_t capacity, unsigned int val_bits);
+// sets up an empty table for up to capacity entries, or with a path
+// keeps it in that file, attaching to the entries already there; returns
+// 0 on success
+int table_init(struct table *t, size_t capacity, unsigned int key_bits,
+		unsigned int val_bits, const char *path);
+// inserts key -> val (val must be non-zero and fit into val_bits), returns 0
+// if inserted, 1 if the key was present already (its value is put into old),
+// -1 if the table is full and -2 if the key's probe sequence ran longer than
+// the displacement field can record (a cluster of the linear probing)
+int table_insert(struct table *t, uint64_t key, uint64_t val, uint64_t *old);
+// returns the value stored for key, 0 if there is none
+uint64_t table_get(const struct table *t, uint64_t key);
+// starts loading the key's home slot, so that the lookups of a batch of
+// keys can be prefetched first and their cache misses overlap
+void table_prefetch(const struct table *t, uint64_t key);
+void table_free(struct table *t);
+
+#endif //TABLE_H
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chain.h"
+#include "filter.h"
+#include "search.h"
+#include "segment.h"
+#include "sort.h"
+#include "table.h"
+
+// Small deterministic checks of the parts every search relies on: the
+// SHA-256 kernels against the context functions, the quotient filter's
+// lack of false negatives through growing and merging, exact table
+// lookups, and sorted runs and segments with the candidate pairs they
+// should find. Each check prints a line; the exit status is 1 if any
+// of them failed.
+
+#define TEST_DIR "test.XXXXXX"
+// kernels to compare, the ones the CPU doesn't support are skipped
+static const char *const kernels[] = { "avx512", "avx2", "shani", "scalar" };
+// keys for the filter and table checks
+#define TEST_KEYS 100000UL
+// records for the sort and segment checks, with so few key bits that
+// most keys come up several times
+#define TEST_RECORDS 20000UL
+#define TEST_RECORD_KEY_BITS 12
+#define TEST_MAX_BLOCK 4000UL
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int failures;
+
+
+static void check(int ok, const char *name, const char *detail) {
+	if (ok) {
+		printf("ok   %s\n", name);
+	} else {
+		printf("FAIL %s: %s\n", name, detail);
+		failures++;
+	}
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned char *random_keys(unsigned long n, uint64_t seed) {
+	// n trimmed hashes of the current prefix length, back to back
+	unsigned char *keys = malloc(n * hashlen);
+	unsigned char key[SHA256_HASH_SIZE];
+
+	for (unsigned long i = 0; keys && i < n; i++) {
+		for (size_t j = 0; j < SHA256_HASH_SIZE; j += sizeof(uint64_t)) {
+			uint64_t x = splitmix64(&seed);
+			memcpy(key + j, &x, sizeof(x));
+		}
+		trim_hash(key);
+		memcpy(keys + i * hashlen, key, hashlen);
+	}
+
+	return keys;
+}
+
+
+static void test_sha(void) {
+	// the context functions of the scalar kernel are the reference, and
+	// they're checked against a known digest first
+	static const unsigned char abc_digest[SHA256_HASH_SIZE] = {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+		0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+		0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	};
+	static unsigned char ref[SHA256_SHORT_MAX_BITS + 1][MAX_CHAINS][SHA256_HASH_SIZE];
+	unsigned char data[MAX_CHAINS][64];
+	unsigned char digest[MAX_CHAINS][SHA256_HASH_SIZE];
+	SHA256_Context ctx;
+	uint64_t seed = 1;
+
+	for (size_t i = 0; i < sizeof(data) / sizeof(uint64_t); i++) {
+		uint64_t x = splitmix64(&seed);
+
+		memcpy(data[0] + i * sizeof(x), &x, sizeof(x));
+	}
+
+	sha256_select_kernel("scalar");
+	sha256_initialize(&ctx);
+	sha256_add_bytes(&ctx, "abc", 3);
+	sha256_calculate(&ctx, digest[0]);
+	check(memcmp(digest[0], abc_digest, SHA256_HASH_SIZE) == 0,
+			"sha256 context of \"abc\"", "wrong digest");
+
+	for (size_t bits = 0; bits <= SHA256_SHORT_MAX_BITS; bits++) {
+		for (unsigned int m = 0; m < MAX_CHAINS; m++) {
+			sha256_initialize(&ctx);
+			sha256_add_bits(&ctx, data[m], bits);
+			sha256_calculate(&ctx, ref[bits][m]);
+		}
+	}
+
+	for (size_t k = 0; k < NUM_KERNELS; k++) {
+		char name[64], detail[64] = "";
+
+		if (sha256_select_kernel(kernels[k]) != SHA_DIGEST_OK) {
+			printf("skip sha256 %s kernel, not supported here\n", kernels[k]);
+			continue;
+		}
+
+		// every length of a single block, through all three ways in,
+		// and a varying number of messages for the multi-buffer kernels
+		for (size_t bits = 0; bits <= SHA256_SHORT_MAX_BITS && !*detail; bits++) {
+			size_t count = bits % MAX_CHAINS + 1;
+
+			for (unsigned int m = 0; m < MAX_CHAINS && !*detail; m++) {
+				sha256_initialize(&ctx);
+				sha256_add_bits(&ctx, data[m], bits);
+				sha256_calculate(&ctx, digest[m]);
+				if (memcmp(digest[m], ref[bits][m], SHA256_HASH_SIZE)) {
+					snprintf(detail, sizeof(detail), "context, %zu bits", bits);
+				}
+
+				sha256_short(data[m], bits, digest[m]);
+				if (!*detail && memcmp(digest[m], ref[bits][m], SHA256_HASH_SIZE)) {
+					snprintf(detail, sizeof(detail), "sha256_short, %zu bits", bits);
+				}
+			}
+
+			sha256_short_many(data, sizeof(data[0]), bits, count, digest[0]);
+			for (unsigned int m = 0; m < count && !*detail; m++) {
+				if (memcmp(digest[m], ref[bits][m], SHA256_HASH_SIZE)) {
+					snprintf(detail, sizeof(detail),
+							"sha256_short_many, %zu bits, message %u of %zu",
+							bits, m, count);
+				}
+			}
+		}
+
+		snprintf(name, sizeof(name), "sha256 %s kernel, 0-%d bits",
+				sha256_kernel_name(), SHA256_SHORT_MAX_BITS);
+		check(!*detail, name, detail);
+	}
+
+	sha256_select_kernel(NULL);
+}
+
+static int check_keys(struct filter *f, const unsigned char *keys,
+		unsigned long n) {
+	for (unsigned long i = 0; i < n; i++) {
+		if (!f->ops->check(f, keys + i * hashlen)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void test_quotient(void) {
+	// started far below the keys' number, so it has to grow repeatedly
+	unsigned char *keys = random_keys(2 * TEST_KEYS, 2);
+	struct filter f, other;
+	int added = 1;
+
+	if (keys == NULL || filter_init(&f, &filter_quotient, bitlen, 1000,
+			DEFAULT_FPR, NULL, 0)) {
+		check(0, "quotient filter", "setup failed");
+		free(keys);
+		return;
+	}
+
+	for (unsigned long i = 0; i < TEST_KEYS; i++) {
+		added &= f.ops->add(&f, keys + i * hashlen) == 0;
+	}
+	check(added, "quotient filter add while growing", "an add failed");
+	check(check_keys(&f, keys, TEST_KEYS),
+			"quotient filter has every key after growing", "a key is missing");
+
+	if (filter_init(&other, &filter_quotient, bitlen, 1000, DEFAULT_FPR,
+			NULL, 0)) {
+		check(0, "quotient filter merge", "setup failed");
+		f.ops->free(&f);
+		free(keys);
+		return;
+	}
+	for (unsigned long i = TEST_KEYS; i < 2 * TEST_KEYS; i++) {
+		other.ops->add(&other, keys + i * hashlen);
+	}
+	check(f.ops->merge(&f, &other) == 0, "quotient filter merge",
+			"merge failed");
+	check(check_keys(&f, keys, 2 * TEST_KEYS),
+			"quotient filter has every key of both after merging",
+			"a key is missing");
+
+	other.ops->free(&other);
+	f.ops->free(&f);
+	free(keys);
+}
+
+static void test_table(void) {
+	// distinct keys spread over the whole key space: multiples of an
+	// odd number modulo 2^key_bits
+	unsigned int key_bits = 40;
+	uint64_t mask = (1ULL << key_bits) - 1, old = 0;
+	struct table t;
+	int ok = 1;
+
+	if (table_init(&t, TEST_KEYS, key_bits, 32, NULL)) {
+		check(0, "table", "setup failed");
+		return;
+	}
+
+	for (unsigned long i = 0; i < TEST_KEYS && ok; i++) {
+		ok = table_insert(&t, (i * 0x9e3779b97f4a7c15ULL) & mask, i + 1, &old) == 0;
+
+		// halfway, a full table fails every insert, even of keys it has
+		if (i == TEST_KEYS / 2) {
+			check(table_insert(&t, 0, 7, &old) == 1 && old == 1,
+					"table keeps the first value of a key", "it was replaced");
+		}
+	}
+	check(ok, "table insert up to capacity", "an insert failed");
+
+	for (unsigned long i = 0; i < TEST_KEYS && ok; i++) {
+		ok = table_get(&t, (i * 0x9e3779b97f4a7c15ULL) & mask) == i + 1;
+	}
+	check(ok, "table finds every value", "wrong value");
+
+	for (unsigned long i = TEST_KEYS; i < 2 * TEST_KEYS && ok; i++) {
+		ok = table_get(&t, (i * 0x9e3779b97f4a7c15ULL) & mask) == 0;
+	}
+	check(ok, "table finds no value for keys never inserted", "a value");
+
+	table_free(&t);
+}
+
+// the records of the sort checks: steps 1 to n with random keys
+static struct sort_record *random_records(size_t n) {
+	struct sort_record *r = malloc(n * sizeof(*r));
+	uint64_t seed = 3;
+
+	for (size_t i = 0; r && i < n; i++) {
+		r[i].key = splitmix64(&seed) & ((1ULL << TEST_RECORD_KEY_BITS) - 1);
+		r[i].step = i + 1;
+	}
+
+	return r;
+}
+
+static int is_sorted(const struct sort_record *r, size_t n) {
+	// on the key, and equal keys in step order
+	for (size_t i = 1; i < n; i++) {
+		if (r[i - 1].key > r[i].key ||
+				(r[i - 1].key == r[i].key && r[i - 1].step >= r[i].step)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int cmp_pair(const void *x, const void *y) {
+	const struct sort_pair *a = x, *b = y;
+
+	if (a->second != b->second) {
+		return (a->second > b->second) - (a->second < b->second);
+	}
+	return (a->first > b->first) - (a->first < b->first);
+}
+
+static int same_pairs(struct sort_pairs *got, struct sort_pairs *want) {
+	qsort(got->pairs, got->len, sizeof(*got->pairs), cmp_pair);
+	qsort(want->pairs, want->len, sizeof(*want->pairs), cmp_pair);
+
+	return got->len == want->len && (got->len == 0 ||
+			memcmp(got->pairs, want->pairs, got->len * sizeof(*got->pairs)) == 0);
+}
+
+// the pairs sort_merge() and segment_merge() should find for records
+// from..to-1: each with the latest earlier step of the same key, if any
+static int expected_pairs(const struct sort_record *r, size_t from, size_t to,
+		struct sort_pairs *want) {
+	uint64_t last[1 << TEST_RECORD_KEY_BITS] = { 0 };
+
+	want->len = 0;
+	for (size_t i = 0; i < to; i++) {
+		if (i >= from && last[r[i].key] &&
+				sort_pairs_add(want, last[r[i].key], r[i].step)) {
+			return 1;
+		}
+		last[r[i].key] = r[i].step;
+	}
+
+	return 0;
+}
+
+static void test_sort(void) {
+	struct sort_record *records = random_records(TEST_RECORDS);
+	struct sort_record *block = malloc(2 * TEST_MAX_BLOCK * sizeof(*block));
+	struct sort_run run = { 0 };
+	struct sort_pairs got = { 0 }, want = { 0 };
+	uint64_t seed = 4;
+	int sorted = 1, merged = 1, pairs = 1;
+
+	if (records == NULL || block == NULL) {
+		check(0, "sort", "setup failed");
+		free(records);
+		free(block);
+		return;
+	}
+
+	// blocks of random sizes, merged one after the other
+	for (size_t done = 0; done < TEST_RECORDS; ) {
+		size_t n = 1 + splitmix64(&seed) % TEST_MAX_BLOCK;
+
+		n = n < TEST_RECORDS - done ? n : TEST_RECORDS - done;
+		memcpy(block, records + done, n * sizeof(*block));
+
+		if (sort_records(block, block + TEST_MAX_BLOCK, n, TEST_RECORD_KEY_BITS) ||
+				sort_merge(&run, block, n, &got) ||
+				expected_pairs(records, done, done + n, &want)) {
+			check(0, "sort", "out of memory");
+			break;
+		}
+		sorted &= is_sorted(block, n);
+		merged &= run.len == done + n && is_sorted(run.records, run.len);
+		pairs &= same_pairs(&got, &want);
+
+		got.len = 0;
+		done += n;
+	}
+	check(sorted, "sort_records sorts blocks stably", "out of order");
+	check(merged, "sort_merge keeps the run sorted", "out of order");
+	check(pairs, "sort_merge finds exactly the equal neighbours",
+			"wrong candidate pairs");
+
+	free(run.records);
+	free(got.pairs);
+	free(want.pairs);
+	free(block);
+	free(records);
+}
+
+static void test_segments(void) {
+	// a merged segment of the first half and a few new ones after it
+	struct sort_record *records = random_records(TEST_RECORDS);
+	struct sort_record *sorted = malloc(TEST_RECORDS * sizeof(*sorted));
+	struct sort_record *scratch = malloc(TEST_RECORDS * sizeof(*scratch));
+	size_t bounds[] = { 0, TEST_RECORDS / 2, TEST_RECORDS * 5 / 8,
+			TEST_RECORDS * 7 / 8, TEST_RECORDS };
+	size_t num = sizeof(bounds) / sizeof(bounds[0]) - 1, len = 0, records_out = 0;
+	struct sort_pairs got = { 0 }, want = { 0 };
+	char dir[] = TEST_DIR, paths[sizeof(bounds) / sizeof(bounds[0])][64] = { "" };
+	const char *inputs[sizeof(bounds) / sizeof(bounds[0]) - 1];
+	struct segment_reader r;
+	const struct sort_record *rec;
+	int ok = 1;
+
+	if (records == NULL || sorted == NULL || scratch == NULL ||
+			mkdtemp(dir) == NULL) {
+		check(0, "segment merge", "setup failed");
+		free(records);
+		free(sorted);
+		free(scratch);
+		return;
+	}
+
+	for (size_t s = 0; s < num && ok; s++) {
+		struct segment_writer w;
+		size_t n = bounds[s + 1] - bounds[s];
+
+		snprintf(paths[s], sizeof(paths[s]), "%s/%zu", dir, s);
+		inputs[s] = paths[s];
+		memcpy(sorted, records + bounds[s], n * sizeof(*sorted));
+		ok = sort_records(sorted, scratch, n, TEST_RECORD_KEY_BITS) == 0 &&
+				segment_create(&w, paths[s]) == 0;
+		ok = ok && (segment_append(&w, sorted, n) | segment_finish(&w)) == 0;
+	}
+	snprintf(paths[num], sizeof(paths[num]), "%s/out", dir);
+	ok = ok && segment_merge(inputs, num, 1, paths[num], &got, &records_out) == 0;
+	check(ok, "segment merge", "writing or merging the segments failed");
+
+	if (ok && segment_open(&r, paths[num]) == 0) {
+		while (len < TEST_RECORDS && segment_next(&r, &rec) == 0 && rec) {
+			sorted[len++] = *rec;
+		}
+		segment_close(&r);
+	}
+	check(ok && records_out == TEST_RECORDS && len == TEST_RECORDS &&
+			is_sorted(sorted, len), "segment merge output is sorted",
+			"out of order or records missing");
+	check(ok && expected_pairs(records, bounds[1], TEST_RECORDS, &want) == 0 &&
+			same_pairs(&got, &want),
+			"segment merge finds exactly the equal neighbours of new records",
+			"wrong candidate pairs");
+
+	for (size_t s = 0; s <= num; s++) {
+		unlink(paths[s]);
+	}
+	rmdir(dir);
+	free(got.pairs);
+	free(want.pairs);
+	free(scratch);
+	free(sorted);
+	free(records);
+}
+
+
+int main(void) {
+	// the filter keys are hash prefixes of the default length (or the
+	// one a CHAIN_BITS build is made for)
+	chain_init(BITLEN_DEFAULT);
+
+	test_sha();
+	test_quotient();
+	test_table();
+	test_sort();
+	test_segments();
+
+	if (failures) {
+		printf("%d check%s failed.\n", failures, failures == 1 ? "" : "s");
+		return 1;
+	}
+	printf("All checks passed.\n");
+
+	return 0;
+}